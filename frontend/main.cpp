@@ -1,6 +1,7 @@
 #include <iostream>
-#include <strstream>
 #include <cstdlib>
+#include <cstring>
+#include <sstream>
 #include "ast_manager.h"
 #include "context.h"
 #include "context_scheduler.h"
@@ -8,9 +9,9 @@
 
 // test harness
 
-static char * mk_ines_rom(uint8_t mapper, char * prg_rom, uint8_t prg_pages, char * chr_rom, uint8_t chr_pages) {
+static uint8_t * mk_ines_rom(uint8_t mapper, char * prg_rom, uint8_t prg_pages, char * chr_rom, uint8_t chr_pages) {
     // TODO other flag bits
-    char * image = new char[16 + (16384 * prg_pages) + (8192 * chr_pages)];
+    uint8_t * image = new uint8_t[16 + (16384 * prg_pages) + (8192 * chr_pages)];
     uint8_t flags6 = ((mapper << 4) & 0xF0) | 0x00;
     uint8_t flags7 = 0x00 | (mapper >> 4);
     // header
@@ -41,10 +42,102 @@ static char * mk_ines_rom(uint8_t mapper, char * prg_rom, uint8_t prg_pages, cha
 int main(int argc, char *argv[]) {
     open_trace();
 
-    // TODO read arguments
-
-    ASTManager_SMT2 mgr;
+    // TODO read more arguments
+    // --solver smt2 (default) pipes queries to an external solver;
+    // --solver sat decides them in-process
+    // --portfolio stp,z3,... races several external solvers on each query
+    // --solver-threads N decides branch queries on N background threads (smt2 only)
+    // --solver-timeout MS, --solver-memory MB and --solver-conflicts N bound each query;
+    // branches the solver cannot decide within them are retried with more effort
+    // up to --solver-retries N times (default 3)
+    // --merge-limit N merges contexts that meet at the same cycle and PC when the merged
+    // state needs at most N ite terms and assumptions (default 16; 0 turns merging off)
+    // --no-state-dedup keeps running contexts whose machine state has been run before
+    // --gc-threshold N frees the expression nodes no context needs any more once there are N of them
+    // (default 1048576; 0 never does)
+    // --rom FILE explores an iNES file instead of the built-in test program
+    ASTManager * mgr_ptr = NULL;
+    std::vector<SolverCommand> portfolio;
+    unsigned int solver_threads = 0;
+    SolverLimits limits;
+    unsigned int solver_retries = 3;
+    unsigned int merge_limit = 16;
+    bool deduplicate_states = true;
+    uint32_t collection_threshold = 1 << 20;
+    const char * rom_filename = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--solver-threads") == 0 && i + 1 < argc) {
+            ++i;
+            solver_threads = strtoul(argv[i], NULL, 10);
+        } else if (strcmp(argv[i], "--solver-timeout") == 0 && i + 1 < argc) {
+            ++i;
+            limits.timeout_ms = strtoul(argv[i], NULL, 10);
+        } else if (strcmp(argv[i], "--solver-memory") == 0 && i + 1 < argc) {
+            ++i;
+            limits.memory_bytes = strtoull(argv[i], NULL, 10) << 20;
+        } else if (strcmp(argv[i], "--solver-conflicts") == 0 && i + 1 < argc) {
+            ++i;
+            limits.conflicts = strtoull(argv[i], NULL, 10);
+        } else if (strcmp(argv[i], "--solver-retries") == 0 && i + 1 < argc) {
+            ++i;
+            solver_retries = strtoul(argv[i], NULL, 10);
+        } else if (strcmp(argv[i], "--merge-limit") == 0 && i + 1 < argc) {
+            ++i;
+            merge_limit = strtoul(argv[i], NULL, 10);
+        } else if (strcmp(argv[i], "--no-state-dedup") == 0) {
+            deduplicate_states = false;
+        } else if (strcmp(argv[i], "--gc-threshold") == 0 && i + 1 < argc) {
+            ++i;
+            collection_threshold = strtoul(argv[i], NULL, 10);
+        } else if (strcmp(argv[i], "--rom") == 0 && i + 1 < argc) {
+            ++i;
+            rom_filename = argv[i];
+        } else if (strcmp(argv[i], "--portfolio") == 0 && i + 1 < argc) {
+            ++i;
+            std::stringstream names(argv[i]);
+            std::string name;
+            while (std::getline(names, name, ',')) {
+                SolverCommand command;
+                if (!SolverCommand::lookup(name, command)) {
+                    std::cerr << "unknown solver " << name << std::endl;
+                    return EXIT_FAILURE;
+                }
+                portfolio.push_back(command);
+            }
+        } else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+            ++i;
+            delete mgr_ptr;
+            if (strcmp(argv[i], "sat") == 0) {
+                mgr_ptr = new ASTManager_SAT();
+            } else if (strcmp(argv[i], "smt2") == 0) {
+                mgr_ptr = new ASTManager_SMT2();
+            } else {
+                std::cerr << "unknown solver " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (mgr_ptr == NULL) {
+        mgr_ptr = new ASTManager_SMT2();
+    }
+    if (!portfolio.empty() || solver_threads > 0) {
+        ASTManager_SMT2 * smt2_mgr = dynamic_cast<ASTManager_SMT2*>(mgr_ptr);
+        if (smt2_mgr == NULL || dynamic_cast<ASTManager_SAT*>(mgr_ptr) != NULL) {
+            std::cerr << "--portfolio and --solver-threads require the smt2 solver" << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!portfolio.empty()) {
+            smt2_mgr->set_solver_commands(portfolio);
+        }
+        smt2_mgr->set_solver_threads(solver_threads);
+    }
+    ASTManager & mgr = *mgr_ptr;
+    mgr.set_query_limits(limits);
     ContextScheduler scheduler;
+    scheduler.set_maximum_solver_retries(solver_retries);
+    scheduler.set_merge_limit(merge_limit);
+    scheduler.set_state_deduplication(deduplicate_states);
+    scheduler.set_collection_threshold(collection_threshold);
 
     Context * initial_context = new Context(mgr, scheduler);
     scheduler.add_context(initial_context);
@@ -101,9 +194,19 @@ int main(int argc, char *argv[]) {
 
     char chr_rom[8192 * chr_pages];
 
-    char * image = mk_ines_rom(0, prg_rom, prg_pages, chr_rom, chr_pages);
-    std::istrstream rom_input(image, 16 + (16384 * prg_pages) + (8192 * chr_pages));
-    initial_context->load_iNES(rom_input);
+    try {
+        if (rom_filename != NULL) {
+            initial_context->load_iNES(rom_filename);
+        } else {
+            uint8_t * image = mk_ines_rom(0, prg_rom, prg_pages, chr_rom, chr_pages);
+            initial_context->load_iNES(RomImage::adopt_buffer(image, 16 + (16384 * prg_pages) + (8192 * chr_pages)));
+        }
+    } catch (const char * msg) {
+        std::cerr << "exception: " << msg << std::endl;
+        delete mgr_ptr;
+        close_trace();
+        return EXIT_FAILURE;
+    }
 
     // set up stopping conditions
     scheduler.set_maximum_cpu_cycles(7 + 2 + 4 + 2 + 4 + 2 + 2 + 2 + 3 + 2 + 2);
@@ -116,6 +219,8 @@ int main(int argc, char *argv[]) {
     } catch (const char * msg) {
         std::cerr << "exception: " << msg << std::endl;
     }
+    // the exploration is over; free all of its expressions at once
+    mgr.release_expressions();
 
     /*
     // simulate a check on (A == 0x41)
@@ -142,8 +247,7 @@ int main(int argc, char *argv[]) {
     }
     */
 
-    delete image;
-    delete initial_context;
+    delete mgr_ptr;
 
     close_trace();
     return EXIT_SUCCESS;
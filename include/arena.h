@@ -0,0 +1,43 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * Bump allocator that hands out memory from large slabs.
+ * Individual allocations are never freed; instead, everything
+ * allocated from the arena is released at once by release()
+ * or when the arena is destroyed.
+ * Objects placed in the arena must be destroyed by their owner
+ * before the arena releases their memory.
+ */
+class Arena {
+public:
+    Arena(size_t slab_size = (1 << 20));
+    ~Arena();
+
+    void * allocate(size_t size);
+    void release();
+    // exchange the slabs of the two arenas
+    void swap(Arena & other);
+
+    size_t get_bytes_allocated() const;
+    size_t get_bytes_reserved() const;
+
+protected:
+    size_t m_slab_size;
+    std::vector<char*> m_slabs;
+    char * m_cursor;
+    char * m_limit;
+    size_t m_bytes_allocated;
+    size_t m_bytes_reserved;
+
+    void new_slab(size_t min_size);
+
+private:
+    Arena(const Arena &);
+    Arena & operator=(const Arena &);
+};
+
+#endif // _ARENA_H_
@@ -4,119 +4,436 @@
 #include <cstdint>
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include "expression.h"
 #include "model.h"
+#include "arena.h"
+#include "sat_solver.h"
+#include "solver_status.h"
+#include "query_cache.h"
+#include "solver_command.h"
+#include "path_condition.h"
+#include <future>
+#include <sys/types.h>
 
-enum ESolverStatus {
-    SAT,
-    UNSAT,
-    UNKNOWN,
-    ERROR
+// a query on its way to the solver: the (sliced) path, the condition, and the node indices that identify it
+struct SolverQuery {
+    std::vector<Expression> path;
+    Expression condition;
+    std::vector<uint32_t> ids;
+    unsigned int effort; // multiplies the manager's query limits
+
+    SolverQuery() : effort(1) {}
+};
+
+/*
+ * The eventual answer to a query started with ASTManager::check_assuming_async().
+ */
+class PendingQuery {
+public:
+    PendingQuery() : m_recorded(true) {}
+
+    bool is_valid() const { return m_answer.valid(); }
+    // true once get_result() would not have to wait
+    bool is_ready() const { return m_answer.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+    void reset() { m_answer = std::shared_future<ESolverStatus>(); }
+
+protected:
+    friend class ASTManager;
+    SolverQuery m_query;
+    std::shared_future<ESolverStatus> m_answer;
+    bool m_recorded; // whether the answer is already in the query cache
 };
 
 class ASTManager {
 public:
-    ASTManager() : m_varID(0) {}
-    virtual ~ASTManager() {}
+    ASTManager();
+    virtual ~ASTManager();
 
     // ground terms
-    virtual Expression * mk_byte(uint8_t val) = 0;
-    virtual Expression * mk_halfword(uint16_t val) = 0;
-    virtual Expression * mk_var(std::string name, unsigned int nBits) = 0;
-    Expression * mk_var(unsigned int nBits); // generate anonymous uniquely-named variable
-    virtual Expression * mk_int(int32_t val) = 0;
-    virtual Expression * mk_bool(bool val) = 0;
+    // (constants are stored inline in the Expression and never allocate)
+    Expression mk_byte(uint8_t val) { return Expression::mk_bv(val, 8); }
+    Expression mk_halfword(uint16_t val) { return Expression::mk_bv(val, 16); }
+    virtual Expression mk_var(std::string name, unsigned int nBits) = 0;
+    Expression mk_var(unsigned int nBits); // generate anonymous uniquely-named variable
+    Expression mk_int(int32_t val) { return Expression::mk_int(val); }
+    Expression mk_bool(bool val) { return Expression::mk_bool(val); }
 
     // boolean terms
-    virtual Expression * mk_and(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_or(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_not(Expression * arg) = 0;
-    virtual Expression * mk_eq(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_assert(Expression * arg) = 0;
+    virtual Expression mk_and(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_or(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_not(Expression arg) = 0;
+    virtual Expression mk_eq(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_assert(Expression arg) = 0;
 
     // bitvector terms
-    virtual Expression * mk_bv_and(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_or(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_xor(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_not(Expression * arg) = 0;
+    virtual Expression mk_bv_and(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_or(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_xor(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_not(Expression arg) = 0;
+
+    virtual Expression mk_bv_neg(Expression arg) = 0;
+    virtual Expression mk_bv_add(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_sub(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_mul(Expression arg0, Expression arg1) = 0;
+
+    virtual Expression mk_bv_concat(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_extract(Expression bv, Expression hi, Expression lo) = 0;
+
+    virtual Expression mk_bv_left_shift(Expression bv, Expression shiftamt) = 0;
+    virtual Expression mk_bv_logical_right_shift(Expression bv, Expression shiftamt) = 0;
+
+    virtual Expression mk_bv_unsigned_less_than(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_unsigned_less_than_or_equal(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_unsigned_greater_than(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_unsigned_greater_than_or_equal(Expression arg0, Expression arg1) = 0;
+
+    virtual Expression mk_bv_signed_less_than(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_signed_less_than_or_equal(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_signed_greater_than(Expression arg0, Expression arg1) = 0;
+    virtual Expression mk_bv_signed_greater_than_or_equal(Expression arg0, Expression arg1) = 0;
 
-    virtual Expression * mk_bv_neg(Expression * arg) = 0;
-    virtual Expression * mk_bv_add(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_sub(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_mul(Expression * arg0, Expression * arg1) = 0;
+    // 'then_expr' if 'cond' holds, else 'else_expr'; both must be booleans or bitvectors of the same width
+    virtual Expression mk_ite(Expression cond, Expression then_expr, Expression else_expr) = 0;
 
-    virtual Expression * mk_bv_concat(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_extract(Expression * bv, Expression * hi, Expression * lo) = 0;
+    virtual ESolverStatus call_solver(std::vector<Expression> & assertions, Model ** model) = 0;
+    /*
+     * Decide the conjunction of 'path' and 'condition'.
+     * 'path' must be ordered root-first and satisfiable by itself: unless a model
+     * is requested, only the path assertions that share variables with the
+     * condition, directly or transitively, are sent to the solver. Backends with an incremental session keep
+     * the path asserted between calls, so a query that shares a prefix of its path
+     * with the previous one only pays for the part that differs.
+     * Results are remembered in a query cache, so that a query implied by
+     * an earlier one never reaches the backend (see solve_assuming()),
+     * and a query satisfied by a recent model is answered without solving.
+     */
+    ESolverStatus check_assuming(std::vector<Expression> & path, Expression condition, Model ** model);
+    /*
+     * Like check_assuming(), but without waiting for the backend if it can work in the background.
+     * The manager itself must only be used from one thread; the answer is collected with get_result().
+     */
+    // 'effort' multiplies the query limits, e.g. to retry a query that ran out of them
+    void check_assuming_async(std::vector<Expression> & path, Expression condition, PendingQuery & pending,
+            unsigned int effort = 1);
+    // the same for a shared path; a condition with no variables in common with the path is checked on its own
+    void check_assuming_async(const PathCondition & path, Expression condition, PendingQuery & pending,
+            unsigned int effort = 1);
+    // 'path' and 'assumption'
+    PathCondition extend_path(const PathCondition & path, Expression assumption);
+    ESolverStatus get_result(PendingQuery & pending);
 
-    virtual Expression * mk_bv_left_shift(Expression * bv, Expression * shiftamt) = 0;
-    virtual Expression * mk_bv_logical_right_shift(Expression * bv, Expression * shiftamt) = 0;
+    // resources for each query decided by a backend (default: unlimited)
+    void set_query_limits(const SolverLimits & limits) { m_query_limits = limits; m_active_limits = limits; }
+    const SolverLimits & get_query_limits() const { return m_query_limits; }
+    const QueryCache & get_query_cache() const { return m_query_cache; }
 
-    virtual Expression * mk_bv_unsigned_less_than(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_unsigned_less_than_or_equal(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_unsigned_greater_than(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_unsigned_greater_than_or_equal(Expression * arg0, Expression * arg1) = 0;
+    virtual std::string to_string(Expression expr) = 0;
 
-    virtual Expression * mk_bv_signed_less_than(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_signed_less_than_or_equal(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_signed_greater_than(Expression * arg0, Expression * arg1) = 0;
-    virtual Expression * mk_bv_signed_greater_than_or_equal(Expression * arg0, Expression * arg1) = 0;
+    // node table
+    const ExpressionNode & get_node(uint32_t id) const {
+        return m_node_chunks[id >> NODE_CHUNK_BITS][id & (NODE_CHUNK_SIZE - 1)];
+    }
+    uint32_t get_num_nodes() const { return m_num_nodes; }
+    // handle for the node with index 'id'; constant nodes are returned as concrete values
+    Expression get_expression(uint32_t id) const;
+    // whether 'expr' is a boolean rather than a bitvector (the two have the same width when it is 1)
+    bool is_boolean(Expression expr) const;
+    const std::string & get_variable_name(uint32_t id) const;
+    // append the variable nodes that 'expr' depends on to 'variables', skipping those already marked in 'visited'
+    void collect_variables(Expression expr, std::vector<bool> & visited, std::vector<uint32_t> & variables);
+    // whether any of 'exprs' depends on one of the (sorted) 'variables'
+    bool depends_on_any(const std::vector<Expression> & exprs, const std::vector<uint32_t> & variables);
+    // append to 'relevant' the assumptions of 'path' that share variables with 'terms', directly or
+    // through other assumptions; the rest are satisfiable on their own and say nothing about 'terms'
+    void get_relevant_assumptions(const PathCondition & path, const std::vector<Expression> & terms, std::vector<Expression> & relevant);
 
-    virtual ESolverStatus call_solver(std::vector<Expression*> & assertions, Model ** model) = 0;
+    // free every expression node created by this manager at once;
+    // all symbolic Expressions obtained from it become invalid
+    void release_expressions();
+
+    /*
+     * Reclaiming the nodes of expressions that are no longer needed, in the middle of a run.
+     * After begin_collection(), whoever holds expressions passes every one that is still needed
+     * to mark_live(); collect_garbage() then moves the marked nodes and their subterms to fresh
+     * storage, in the same order, and frees everything else. Node indices change, so each
+     * marked expression must be replaced by relocate() before any new node is made.
+     * What the manager itself keeps by node index (cached queries, solver sessions) is dropped.
+     */
+    void begin_collection();
+    void mark_live(Expression expr);
+    void mark_live_node(uint32_t id);
+    void mark_live(const PendingQuery & pending);
+    void collect_garbage();
+    Expression relocate(Expression expr) const;
+    uint32_t relocate_node(uint32_t id) const;
+    void relocate(PendingQuery & pending) const;
 
 protected:
     uint64_t m_varID; // variable ID counter
     std::string get_unique_variable_name();
+
+    /*
+     * Nodes are stored in fixed-size chunks allocated from the arena,
+     * so they never move and are addressed by a 32-bit index.
+     * Index 0 is never a valid node.
+     */
+    static const unsigned int NODE_CHUNK_BITS = 12;
+    static const unsigned int NODE_CHUNK_SIZE = (1 << NODE_CHUNK_BITS);
+    Arena m_arena; // backing storage for expression nodes
+    std::vector<ExpressionNode*> m_node_chunks;
+    uint32_t m_num_nodes;
+    // open-addressed hash table of node indices, for hash-consing
+    std::vector<uint32_t> m_node_table;
+    uint32_t m_node_table_entries;
+    std::vector<std::string> m_variable_names;
+    std::unordered_map<std::string, uint32_t> m_variable_ids;
+    // during a collection: nonzero for marked nodes, and then the new index of each node
+    std::vector<uint32_t> m_forwarding;
+
+    QueryCache m_query_cache;
+
+    SolverLimits m_query_limits;
+    // limits for the query the backend is deciding now (scaled by its effort)
+    SolverLimits m_active_limits;
+
+    /*
+     * Recent satisfying assignments, most useful first, each indexed by variable
+     * name index. Sibling and parent branches usually share a model, so a query
+     * is first evaluated under these before it is sent to the solver.
+     */
+    static const size_t MAX_RECENT_MODELS = 16;
+    std::vector<std::vector<uint64_t> > m_recent_models;
+    // scratch space for evaluate(): a value is valid iff its epoch is current
+    std::vector<uint64_t> m_eval_values;
+    std::vector<uint32_t> m_eval_epoch;
+    uint32_t m_eval_current_epoch;
+    std::vector<uint32_t> m_eval_stack;
+
+    // value of the node 'root' under 'assignment' (unassigned variables are 0);
+    // returns false if some subterm is too wide to evaluate.
+    // Values computed since the last next_eval_epoch() are reused.
+    bool evaluate(uint32_t root, const std::vector<uint64_t> & assignment, uint64_t & value);
+    void next_eval_epoch();
+    // look for a recent model satisfying every node in 'query', and copy it to 'model' if it is not NULL
+    bool find_model(const std::vector<uint32_t> & query, Model ** model);
+    void remember_model(const std::vector<uint32_t> & query, Model & model);
+    void remember_model(const std::vector<uint64_t> & assignment);
+    // add the values that 'assignment' gives the variables of 'query' to 'model'
+    void assignment_to_model(const std::vector<uint32_t> & query, const std::vector<uint64_t> & assignment, Model & model);
+
+    /*
+     * Decide 'query' by evaluating it under every assignment of its variables,
+     * many assignments at a time (ast_manager_enum.cpp). Only done when the
+     * variables have at most ENUM_MAX_BITS bits between them; otherwise, and
+     * for terms too wide to evaluate, the result is UNKNOWN.
+     * On SAT, 'assignment' receives a satisfying assignment by variable name index.
+     */
+    static const unsigned int ENUM_MAX_BITS = 16;
+    static const size_t ENUM_MAX_NODES = 4096;
+    ESolverStatus enumerate(const std::vector<uint32_t> & query, std::vector<uint64_t> & assignment);
+    // variables of each assertion root seen by check_assuming(), sorted
+    std::unordered_map<uint32_t, std::vector<uint32_t> > m_assertion_variables;
+    const std::vector<uint32_t> & get_assertion_variables(uint32_t root);
+    // append to 'slice' the assertions of 'path' in the same independent cluster as any of 'terms'
+    void slice_path(std::vector<Expression> & path, const std::vector<Expression> & terms, std::vector<Expression> & slice);
+
+    // forget everything kept by node index, before the nodes are freed or moved
+    virtual void drop_node_references();
+
+    // true if the backend can produce a model with a satisfiable result at little extra cost
+    virtual bool has_cheap_models() const { return false; }
+
+    // slice the query and try to decide it without a solver; returns false if that did not work
+    bool prepare_query(std::vector<Expression> & full_path, Expression condition, Model ** model,
+            SolverQuery & query, ESolverStatus & result);
+    // decide a prepared query with the backend, and remember the result
+    ESolverStatus solve_query(SolverQuery & query, Model ** model);
+    // decide a query that the cache could not; the default implementation simply calls call_solver()
+    virtual ESolverStatus solve_assuming(std::vector<Expression> & path, Expression condition, Model ** model);
+    // start deciding a prepared query in the background; returns false if the backend cannot
+    virtual bool submit_query(SolverQuery & query, std::shared_future<ESolverStatus> & answer);
+
+    // index of the unique node structurally equal to 'node', creating it if necessary
+    uint32_t mk_node(const ExpressionNode & node);
+    // node for 'expr', creating a constant node if it is concrete
+    uint32_t to_node(Expression expr);
+
+    Expression mk_app(EOpcode op, Expression arg);
+    Expression mk_app(EOpcode op, Expression arg0, Expression arg1);
+    Expression mk_app(EOpcode op, Expression arg0, Expression arg1, Expression arg2);
+    Expression mk_extract_app(Expression bv, uint32_t hi, uint32_t lo);
+    Expression mk_var_app(std::string name, unsigned int nBits);
+
+    /*
+     * Construction-time simplification (ast_manager_rewrite.cpp).
+     * Backends call these instead of mk_app() once they have ruled out
+     * full constant folding; they apply local rewrite rules, building
+     * the result through the mk_* methods so that it is simplified as well,
+     * and only create a new node if no rule applies.
+     */
+    Expression rewrite(EOpcode op, Expression arg);
+    Expression rewrite(EOpcode op, Expression arg0, Expression arg1);
+    Expression rewrite_extract(Expression bv, uint32_t hi, uint32_t lo);
+    Expression rewrite_ite(Expression cond, Expression then_expr, Expression else_expr);
+
+private:
+    // fold an operator whose operands are all concrete
+    Expression fold(EOpcode op, Expression arg0, Expression arg1);
+    // dispatch to the mk_* method for a binary operator
+    Expression mk_binary(EOpcode op, Expression arg0, Expression arg1);
+
+    void reset_node_table();
+    void grow_node_table();
 };
 
+class SMT2Writer;
+class SolverPool;
+
 class ASTManager_SMT2 : public ASTManager {
 public:
-    ASTManager_SMT2() {}
-    virtual ~ASTManager_SMT2() {}
+    ASTManager_SMT2();
+    virtual ~ASTManager_SMT2();
 
-    Expression * mk_byte(uint8_t val);
-    Expression * mk_halfword(uint16_t val);
-    Expression * mk_var(std::string name, unsigned int nBits);
-    Expression * mk_int(int32_t val);
-    Expression * mk_bool(bool val);
+    Expression mk_var(std::string name, unsigned int nBits);
 
     // boolean terms
-    Expression * mk_and(Expression * arg0, Expression * arg1);
-    Expression * mk_or(Expression * arg0, Expression * arg1);
-    Expression * mk_not(Expression * arg);
-    Expression * mk_eq(Expression * arg0, Expression * arg1);
-    Expression * mk_assert(Expression * arg);
+    Expression mk_and(Expression arg0, Expression arg1);
+    Expression mk_or(Expression arg0, Expression arg1);
+    Expression mk_not(Expression arg);
+    Expression mk_eq(Expression arg0, Expression arg1);
+    Expression mk_assert(Expression arg);
 
     // bitvector terms
-    Expression * mk_bv_and(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_or(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_xor(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_not(Expression * arg);
+    Expression mk_bv_and(Expression arg0, Expression arg1);
+    Expression mk_bv_or(Expression arg0, Expression arg1);
+    Expression mk_bv_xor(Expression arg0, Expression arg1);
+    Expression mk_bv_not(Expression arg);
+
+    Expression mk_bv_neg(Expression arg);
+    Expression mk_bv_add(Expression arg0, Expression arg1);
+    Expression mk_bv_sub(Expression arg0, Expression arg1);
+    Expression mk_bv_mul(Expression arg0, Expression arg1);
 
-    Expression * mk_bv_neg(Expression * arg);
-    Expression * mk_bv_add(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_sub(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_mul(Expression * arg0, Expression * arg1);
+    Expression mk_bv_concat(Expression arg0, Expression arg1);
+    Expression mk_bv_extract(Expression bv, Expression hi, Expression lo);
 
-    Expression * mk_bv_concat(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_extract(Expression * bv, Expression * hi, Expression * lo);
+    Expression mk_bv_left_shift(Expression bv, Expression shiftamt);
+    Expression mk_bv_logical_right_shift(Expression bv, Expression shiftamt);
 
-    Expression * mk_bv_left_shift(Expression * bv, Expression * shiftamt);
-    Expression * mk_bv_logical_right_shift(Expression * bv, Expression * shiftamt);
+    Expression mk_bv_unsigned_less_than(Expression arg0, Expression arg1);
+    Expression mk_bv_unsigned_less_than_or_equal(Expression arg0, Expression arg1);
+    Expression mk_bv_unsigned_greater_than(Expression arg0, Expression arg1);
+    Expression mk_bv_unsigned_greater_than_or_equal(Expression arg0, Expression arg1);
 
-    Expression * mk_bv_unsigned_less_than(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_unsigned_less_than_or_equal(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_unsigned_greater_than(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_unsigned_greater_than_or_equal(Expression * arg0, Expression * arg1);
+    Expression mk_bv_signed_less_than(Expression arg0, Expression arg1);
+    Expression mk_bv_signed_less_than_or_equal(Expression arg0, Expression arg1);
+    Expression mk_bv_signed_greater_than(Expression arg0, Expression arg1);
+    Expression mk_bv_signed_greater_than_or_equal(Expression arg0, Expression arg1);
 
-    Expression * mk_bv_signed_less_than(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_signed_less_than_or_equal(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_signed_greater_than(Expression * arg0, Expression * arg1);
-    Expression * mk_bv_signed_greater_than_or_equal(Expression * arg0, Expression * arg1);
+    Expression mk_ite(Expression cond, Expression then_expr, Expression else_expr);
 
-    ESolverStatus call_solver(std::vector<Expression*> & assertions, Model ** model);
+    /*
+     * One-shot queries are sent to every configured solver at once;
+     * the first definitive answer wins and the other solvers are killed.
+     */
+    ESolverStatus call_solver(std::vector<Expression> & assertions, Model ** model);
+    // solvers to race; the first one also serves incremental queries (default: stp)
+    void set_solver_commands(const std::vector<SolverCommand> & commands);
+    // decide queries from check_assuming_async() on this many threads; 0 (the default) decides
+    // them in the calling thread, through the incremental session
+    void set_solver_threads(unsigned int num_threads);
+
+    std::string to_string(Expression expr);
 
 protected:
-    std::string get_var_decl(Expression * var);
+    std::vector<SolverCommand> m_solver_commands;
+    SolverPool * m_solver_pool;
+
+    void drop_node_references();
+
+    ESolverStatus solve_assuming(std::vector<Expression> & path, Expression condition, Model ** model);
+    bool submit_query(SolverQuery & query, std::shared_future<ESolverStatus> & answer);
+
+    /*
+     * Long-lived solver process used by solve_assuming().
+     * Every element of the asserted path lives in its own (push) level,
+     * together with the variables and shared terms it introduced.
+     */
+    pid_t m_session_pid;
+    int m_session_input;
+    int m_session_output;
+    std::string m_session_buffer; // solver output not consumed yet
+    std::vector<Expression> m_session_path;
+    std::vector<std::vector<uint32_t> > m_session_names; // names introduced at each level
+    std::unordered_set<uint32_t> m_session_declared; // variables in scope
+    std::unordered_set<uint32_t> m_session_defined; // shared terms in scope
+
+    bool start_session();
+    void stop_session();
+    void push_session(Expression assertion, SMT2Writer & out);
+    void pop_session(size_t levels, SMT2Writer & out);
+    bool read_session_line(std::string & line, unsigned int timeout_ms);
+
+    void write_instance(SMT2Writer & out, std::vector<Expression> & assertions);
+    void write_assertions(SMT2Writer & out, std::vector<Expression> & assertions,
+            std::unordered_set<uint32_t> & declared, std::unordered_set<uint32_t> & defined,
+            std::vector<uint32_t> & introduced);
+    void write_var_decl(SMT2Writer & out, uint32_t var);
+    void write_term(SMT2Writer & out, uint32_t id, const std::unordered_set<uint32_t> * defined);
+};
+
+/*
+ * Decides queries in-process by bit-blasting the expression DAG into a CDCL SAT solver.
+ * Terms are built (and printed, for tracing) exactly as by ASTManager_SMT2.
+ */
+class ASTManager_SAT : public ASTManager_SMT2 {
+public:
+    ASTManager_SAT();
+    virtual ~ASTManager_SAT();
+
+    ESolverStatus call_solver(std::vector<Expression> & assertions, Model ** model);
+
+protected:
+    void drop_node_references();
+
+    // queries go to the in-process solver, never to an SMT2 session
+    ESolverStatus solve_assuming(std::vector<Expression> & path, Expression condition, Model ** model) {
+        return ASTManager::solve_assuming(path, condition, model);
+    }
+    bool submit_query(SolverQuery & query, std::shared_future<ESolverStatus> & answer) {
+        return ASTManager::submit_query(query, answer);
+    }
+    // the model is read straight off the solver's assignment
+    bool has_cheap_models() const { return true; }
+
+    /*
+     * The solver and the bit-blasted form of every node persist across queries;
+     * assertions are passed to the solver as assumptions, so a path prefix is
+     * bit-blasted once and what was learnt about it is kept.
+     */
+    SATSolver * m_solver;
+    Literal m_true;
+    std::unordered_map<uint32_t, std::vector<Literal> > m_node_bits;
+    std::unordered_map<uint64_t, Literal> m_and_gates;
+    std::unordered_map<uint64_t, Literal> m_xor_gates;
+
+    void reset_solver();
+    const std::vector<Literal> & blast(uint32_t root);
+    void blast_node(uint32_t id, const ExpressionNode & node);
+
+    Literal mk_false() const { return negate(m_true); }
+    Literal mk_fresh();
+    Literal mk_and_gate(Literal a, Literal b);
+    Literal mk_or_gate(Literal a, Literal b) { return negate(mk_and_gate(negate(a), negate(b))); }
+    Literal mk_xor_gate(Literal a, Literal b);
+    Literal mk_mux_gate(Literal sel, Literal t, Literal e);
+
+    void mk_adder(const std::vector<Literal> & a, const std::vector<Literal> & b, Literal carry, std::vector<Literal> & sum);
+    Literal mk_unsigned_less_than(const std::vector<Literal> & a, const std::vector<Literal> & b);
+    Literal mk_signed_less_than(const std::vector<Literal> & a, const std::vector<Literal> & b);
+    void mk_shift(const std::vector<Literal> & a, const std::vector<Literal> & amount, bool left, std::vector<Literal> & result);
 };
 
 #endif // _AST_MANAGER_H_
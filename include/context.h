@@ -5,20 +5,30 @@
 #include <cstdint>
 #include <vector>
 #include <map>
+#include <unordered_set>
 #include "expression.h"
 #include "ast_manager.h"
 #include "context_scheduler.h"
+#include "rom_image.h"
+#include "paged_ram.h"
+#include "state_digest.h"
 
 class Mapper;
 class ContextScheduler;
 
+// limits on the number of 4KB PRG banks and 1KB CHR banks
 #define MAX_PRG_ROM_SIZE (0x800)
 #define MAX_CHR_ROM_SIZE (0x1000)
 
 class Context;
 
-typedef void (*FCPUWrite) (Context & ctx, uint8_t bank, uint16_t addr, Expression * val);
-typedef Expression* (*FCPURead) (Context & ctx, uint8_t bank, uint16_t addr);
+// outcome of a context's feasibility query
+enum EFeasibility {
+    Path_Feasible, Path_Infeasible, Path_Unknown
+};
+
+typedef void (*FCPUWrite) (Context & ctx, uint8_t bank, uint16_t addr, Expression val);
+typedef Expression (*FCPURead) (Context & ctx, uint8_t bank, uint16_t addr);
 
 // enum to track which device we're going to step next
 enum EDevice {
@@ -53,9 +63,19 @@ public:
     Context(ASTManager & m, ContextScheduler & sch);
     // create inherited context
     Context(ASTManager & m, Context * parent);
-    virtual ~Context();
 
-    void load_iNES(std::istream & in);
+    /*
+     * Contexts are reference counted. A new context holds one reference, which its
+     * creator hands to the scheduler; each child holds one on its parent, which it
+     * reads assumptions and inherited state from. Dropping the last reference frees
+     * the context and drops its reference on its parent in turn.
+     */
+    void retain();
+    void release();
+
+    // map an iNES file, or use an image already in memory; the context takes ownership of 'image'
+    void load_iNES(const char * filename);
+    void load_iNES(RomImage * image);
 
     ASTManager & get_manager();
     ContextScheduler & get_scheduler();
@@ -63,54 +83,121 @@ public:
     int get_priority() const;
     bool has_forked() const;
 
+    // a context created at a symbolic branch waits until the solver has decided whether its path is feasible
+    bool is_waiting_for_solver() const;
+    bool solver_result_ready() const;
+    // wait for the answer; an unknown answer leaves the context to be retried later with more effort
+    EFeasibility resolve_feasibility();
+    // the context's feasibility is still undecided and must be asked again before it runs
+    bool needs_feasibility_retry() const;
+    unsigned int get_unknown_answers() const;
+    void retry_feasibility();
+
     void step();
 
+    /*
+     * State merging. Two contexts at the same point of execution (same cycle, PC and CPU state
+     * phase, same mapper banks and controller state) can go on as one whose path is the disjunction
+     * of theirs; each register, latch and RAM cell in which they differ becomes an ite term that
+     * picks this context's value under the assumptions that set it apart from the other.
+     */
+    // between two instructions, where the scheduler looks for contexts to merge with
+    bool is_at_instruction_boundary() const;
+    bool can_merge_with(const Context & other) const;
+    // how much harder the merged context is to solve for than the two separate ones:
+    // the number of ite terms it needs plus the number of assumptions the disjunction takes in;
+    // counting stops once the cost exceeds 'limit'
+    unsigned int get_merge_cost(const Context & other, unsigned int limit) const;
+    // take in the path and state of 'other', which can_merge_with() must accept; the caller releases 'other'
+    void merge(const Context & other);
+
+    /*
+     * Digest of the machine state: registers, flags, bus and instruction latches, CPU state phase,
+     * mapper banks, controller and RAM, but neither the path nor the cycle count. Between
+     * instructions, the latches and decode state of the previous instruction are left out, as they
+     * are for merging. The RAM part is kept current as RAM is written; the rest is added here.
+     */
+    StateDigest get_state_digest() const;
+    // hash, like PathCondition::get_hash(), of the assumptions on the path that constrain the state
+    // directly or through other assumptions; the future of the context depends on no others, so
+    // two contexts with the same state and the same such assumptions behave alike
+    uint64_t get_state_path_hash() const;
+    const PathCondition & get_path() const;
+
+    // for ASTManager::collect_garbage(): mark every expression of this context and its ancestors
+    // as live, and later replace each by its relocated node; contexts, path cells and RAM pages
+    // in 'visited' have been seen through another context already
+    void mark_live(std::unordered_set<const void*> & visited) const;
+    void relocate_expressions(std::unordered_set<const void*> & visited);
+
     // CPU
     uint64_t get_cpu_cycle_count();
     void step_cpu();
     void cpu_reset();
-    void cpu_read(Expression * address);
-    void cpu_write(Expression * address, Expression * data);
-
-    Expression * get_cpu_A();
-    Expression * get_cpu_X();
-    Expression * get_cpu_Y();
-    Expression * get_cpu_SP();
-    Expression * get_cpu_PC();
-
-    Expression * get_cpu_FN();
-    Expression * get_cpu_FV();
-    Expression * get_cpu_FD();
-    Expression * get_cpu_FI();
-    Expression * get_cpu_FZ();
-    Expression * get_cpu_FC();
-
-    Expression ** get_cpu_RAM();
-    Expression * cpu_read_ram(uint16_t addr);
-    void cpu_write_ram(uint16_t addr, Expression * value);
-    Expression *** get_cpu_PRG_pointer();
+    void cpu_read(Expression address);
+    void cpu_write(Expression address, Expression data);
+
+    Expression get_cpu_A();
+    Expression get_cpu_X();
+    Expression get_cpu_Y();
+    Expression get_cpu_SP();
+    Expression get_cpu_PC();
+
+    Expression get_cpu_FN();
+    Expression get_cpu_FV();
+    Expression get_cpu_FD();
+    Expression get_cpu_FI();
+    Expression get_cpu_FZ();
+    Expression get_cpu_FC();
+
+    Expression cpu_read_ram(uint16_t addr);
+    void cpu_write_ram(uint16_t addr, Expression value);
+    const uint8_t ** get_cpu_PRG_pointer();
+    uint8_t * get_cpu_PRG_RAM_bank();
     bool * get_cpu_readable();
     bool * get_cpu_writable();
-    Expression * get_cpu_address();
-    Expression * get_cpu_last_read();
+    Expression get_cpu_address();
+    Expression get_cpu_last_read();
 
-    Expression *** get_cpu_PRG_ROM();
+    const uint8_t * get_cpu_PRG_ROM();
     uint32_t get_prg_mask_rom();
+    uint32_t get_prg_size_rom();
+    // allocated the first time a mapper maps one of its banks
+    PagedRAM & get_cpu_PRG_RAM();
+    uint32_t get_prg_size_ram();
 
     // Controller
-    void controller_write(Expression * val);
-    Expression * controller_read1();
-    Expression * controller_read2();
-    std::vector<Expression*> & get_controller1_inputs();
+    void controller_write(Expression val);
+    Expression controller_read1();
+    Expression controller_read2();
+    std::vector<Expression> & get_controller1_inputs();
 
 protected:
     ASTManager & m;
     ContextScheduler & sch;
     Context * m_parent_context;
+    unsigned int m_references;
     bool m_has_forked;
-
-    std::vector<Expression*> m_symbolic_assumptions;
-    void collect_assumptions(std::vector<Expression*> & buffer);
+    // how often the solver could not decide whether this context is feasible
+    unsigned int m_unknown_answers;
+    bool m_feasibility_unknown;
+    // retries stop doubling the solver's effort after this many answers
+    static const unsigned int MAX_RETRY_DOUBLINGS = 16;
+
+    // the assumptions of this context and all of its ancestors, shared with them
+    PathCondition m_path;
+    PendingQuery m_feasibility_query;
+
+    // the state that merge() combines with ite terms; everything else must be equal.
+    // The registers come first, followed by the latches of the instruction in progress, which are
+    // dead between instructions because the next instruction overwrites them before reading them
+    static Expression Context::* const merged_state[];
+    static const size_t num_merged_registers;
+    static const size_t num_merged_state;
+    // the part of merged_state that is live
+    size_t get_num_live_state() const;
+    // the conjunction of the assumptions of 'path' after its first 'prefix_size' ones
+    Expression get_path_suffix(const PathCondition & path, size_t prefix_size) const;
 
     uint64_t m_step_count;
 
@@ -131,8 +218,11 @@ protected:
     uint32_t m_mapper_chr_size_rom;
     uint32_t m_mapper_chr_size_ram;
 
-    Expression *** m_PRG_ROM;
-    Expression *** m_CHR_ROM;
+    // cartridge ROM as raw bytes inside the image, m_mapper_prg_size_rom banks of 4KB and
+    // m_mapper_chr_size_rom banks of 1KB; reads turn bytes into (concrete) expressions as they happen
+    RomImage * m_rom_image; // owned by the root context
+    const uint8_t * m_PRG_ROM;
+    const uint8_t * m_CHR_ROM;
 
     /* *
      * ***
@@ -148,8 +238,8 @@ protected:
     uint8_t m_cpu_execute_cycle;
     void instruction_fetch();
     bool decode_addressing_mode();
-    Expression * m_cpu_calc_addr;
-    Expression * m_cpu_branch_offset;
+    Expression m_cpu_calc_addr;
+    Expression m_cpu_branch_offset;
     void cpu_addressing_mode_cycle();
     void cpu_execute();
     void cpu_branch(ECPUStatusFlag testedFlag, bool polarity);
@@ -157,13 +247,16 @@ protected:
     void increment_PC();
 
     // macros for flags in P
-    void cpu_set_FC(Expression * test);
-    void cpu_set_FZ(Expression * test);
-    void cpu_set_FN(Expression * test);
+    void cpu_set_FC(Expression test);
+    void cpu_set_FZ(Expression test);
+    void cpu_set_FN(Expression test);
 
     FCPURead m_cpu_read_handler[0x10];
     FCPUWrite m_cpu_write_handler[0x10];
-    Expression ** m_cpu_prg_pointer[0x10];
+    // banks whose pointer is NULL map bank m_cpu_prg_ram_bank[] of PRG RAM instead of ROM;
+    // the others point into the read-only ROM image
+    const uint8_t * m_cpu_prg_pointer[0x10];
+    uint8_t m_cpu_prg_ram_bank[0x10];
     bool m_cpu_readable[0x10];
     bool m_cpu_writable[0x10];
 
@@ -172,31 +265,33 @@ protected:
     uint8_t m_cpu_pcm_cycles;
 
     // CPU registers
-    Expression * m_cpu_A; // 8 bits
-    Expression * m_cpu_X; // 8 bits
-    Expression * m_cpu_Y; // 8 bits
-    Expression * m_cpu_SP; // 8 bits
-    Expression * m_cpu_PC; // 16 bits
+    Expression m_cpu_A; // 8 bits
+    Expression m_cpu_X; // 8 bits
+    Expression m_cpu_Y; // 8 bits
+    Expression m_cpu_SP; // 8 bits
+    Expression m_cpu_PC; // 16 bits
     // We don't store the P register per se;
     // instead we track each bit separately
     // P = [7] N V - - D I Z C [0]
     // *** NOTE THAT THESE ARE BOOLEANS ***
-    Expression * m_cpu_FC;
-    Expression * m_cpu_FZ;
-    Expression * m_cpu_FI;
-    Expression * m_cpu_FD;
-    Expression * m_cpu_FV;
-    Expression * m_cpu_FN;
+    Expression m_cpu_FC;
+    Expression m_cpu_FZ;
+    Expression m_cpu_FI;
+    Expression m_cpu_FD;
+    Expression m_cpu_FV;
+    Expression m_cpu_FN;
 
     // CPU address bus
-    Expression * m_cpu_last_read;
-    Expression * m_cpu_address;
+    Expression m_cpu_last_read;
+    Expression m_cpu_address;
     bool m_cpu_write_enable;
-    Expression * m_cpu_data_out;
+    Expression m_cpu_data_out;
 
-    //Expression * m_cpu_ram[0x800];
-    Expression ** m_cpu_ram;
-    std::map<uint16_t, Expression*> m_cpu_ram_copyonwrite;
+    // shares its pages with the parent's RAM until either of them writes to them
+    PagedRAM m_cpu_ram;
+    // the cartridge's RAM, m_mapper_prg_size_ram banks of 4KB once it is in use; symbolic
+    // writes go to its overlay like those to CPU RAM
+    PagedRAM m_cpu_prg_ram;
 
     /* *
      * ***********
@@ -209,14 +304,16 @@ protected:
 
     // standard controller reads buttons in the order A B Select Start Up Down Left Right
 
-    Expression * m_controller1_bits;
+    Expression m_controller1_bits;
     uint8_t m_controller1_bit_ptr;
     bool m_controller1_strobe;
     uint32_t m_controller1_seqno;
-    std::vector<Expression*> m_controller1_inputs;
+    std::vector<Expression> m_controller1_inputs;
 
-    Expression * controller_mk_var(int controller_number);
+    Expression controller_mk_var(int controller_number);
 
+    // only release() destroys contexts
+    virtual ~Context();
 };
 
 #endif // _CONTEXT_H_
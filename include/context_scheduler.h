@@ -2,7 +2,10 @@
 #define _CONTEXT_SCHEDULER_H_
 
 #include "context.h"
+#include "state_digest.h"
 #include <queue>
+#include <map>
+#include <unordered_set>
 #include <vector>
 #include <cstdint>
 
@@ -20,15 +23,69 @@ public:
     virtual ~ContextScheduler();
 
     void set_maximum_cpu_cycles(uint64_t max_cycles);
+    // contexts whose feasibility is still unknown after this many attempts are abandoned
+    void set_maximum_solver_retries(unsigned int max_retries);
+    // contexts that meet at the same point of execution are merged if that costs at most this much
+    // (see Context::get_merge_cost()); 0 turns merging off
+    void set_merge_limit(unsigned int limit);
+    // drop contexts whose machine state has been run before (default: on)
+    void set_state_deduplication(bool enabled);
+    // reclaim the expression nodes that no context needs any more once there are this many
+    // (default 1M); 0 never does
+    void set_collection_threshold(uint32_t num_nodes);
 
     void add_context(Context * ctx);
     void run_next_context();
     bool have_contexts();
 protected:
     std::priority_queue<Context*, std::vector<Context*>, context_priority_cmp> m_run_queue;
-    std::vector<Context*> m_completed_contexts;
+    std::vector<Context*> m_waiting_contexts; // waiting for the solver to decide their feasibility
+    // the scheduler holds one reference on every context in m_run_queue and m_waiting_contexts;
+    // contexts that fork or finish are released, so explored subtrees are freed as soon as
+    // no live descendant needs them
+
+    /*
+     * With merging on, contexts run in lockstep: a context that reaches an instruction boundary
+     * merges with any context parked at the same cycle and PC, and then parks itself while other
+     * contexts may still be behind it. Parked contexts resume oldest cycle first. The scheduler
+     * holds a reference on every parked context too.
+     */
+    std::multimap<uint64_t, Context*> m_parked_contexts;
+
+    /*
+     * Digests of the states (see Context::get_state_digest()) that contexts were in when they were
+     * picked to run. A context picked in a state that is already here would only repeat what the
+     * context that put it here explores, and is dropped. The assumptions of the path that constrain
+     * the state are added as well, as paths that differ in them may allow different futures.
+     */
+    std::unordered_set<StateDigest, StateDigestHash> m_visited_states;
+    bool m_deduplicate_states;
 
     uint64_t m_maximum_cpu_cycles;
+    unsigned int m_maximum_solver_retries;
+    unsigned int m_merge_limit;
+
+    /*
+     * Expression nodes are collected between two runs of a context, when every context the
+     * scheduler holds is in one of its queues. The next collection waits until the number of
+     * nodes has at least doubled over what the last one kept, so that each costs time in
+     * proportion to the nodes it frees.
+     */
+    uint32_t m_collection_threshold;
+    uint32_t m_next_collection;
+
+    // move waiting contexts whose answer has arrived to the run queue (or discard them if infeasible);
+    // undecided contexts go back to the run queue at a lower priority, to be asked again when they come up;
+    // if 'block' is set and nothing is runnable, wait until something is
+    void admit_waiting_contexts(bool block);
+    // merge a context that has reached an instruction boundary with the contexts parked there;
+    // returns true if the context was parked and must stop running for now
+    bool reach_join_point(Context * ctx);
+    // record the state of a context about to run; returns false if it has been visited before
+    bool visit_state(Context * ctx);
+    // free the expression nodes that neither 'ctx', taken off the queues to run next, nor any
+    // queued context refers to
+    void collect_garbage(Context * ctx);
 };
 
 #endif // _CONTEXT_SCHEDULER_H_
@@ -4,19 +4,95 @@
 #include <cstdint>
 #include <string>
 
+// operators of expression nodes
+enum EOpcode {
+    OP_NULL,
+    // leaves
+    OP_BOOL_CONST, OP_BV_CONST, OP_INT_CONST, OP_VAR,
+    // boolean terms
+    OP_AND, OP_OR, OP_NOT, OP_EQ, OP_ASSERT,
+    // bitvector terms
+    OP_BV_AND, OP_BV_OR, OP_BV_XOR, OP_BV_NOT,
+    OP_BV_NEG, OP_BV_ADD, OP_BV_SUB, OP_BV_MUL,
+    OP_BV_CONCAT, OP_BV_EXTRACT,
+    OP_BV_SHL, OP_BV_LSHR,
+    OP_BV_ULT, OP_BV_ULE, OP_BV_UGT, OP_BV_UGE,
+    OP_BV_SLT, OP_BV_SLE, OP_BV_SGT, OP_BV_SGE,
+    // if-then-else over booleans or bitvectors: args[0] is the (boolean) condition
+    OP_ITE,
+    OP_NUM_OPCODES
+};
+
+// the node depends on at least one variable
+#define NODE_SYMBOLIC (0x01)
+
+/*
+ * A node of an expression DAG, stored by value in the node table of the ASTManager
+ * that created it and referred to by its 32-bit index in that table.
+ * For operators, 'args' holds the indices of the children.
+ * Leaves and extract keep immediate operands there instead:
+ *   constants: args[0] = low 32 bits of the value, args[1] = high 32 bits
+ *   variables: args[0] = index of the variable name
+ *   extract:   args[0] = child, args[1] = high bit, args[2] = low bit
+ * Unused fields are zero, so two nodes are structurally equal iff their bytes are.
+ */
+struct ExpressionNode {
+    uint8_t op;       // EOpcode
+    uint8_t width;    // width of the result in bits; booleans have width 1
+    uint8_t flags;
+    uint8_t num_args; // number of children
+    uint32_t args[3];
+};
+
+enum EExpressionKind {
+    EXPR_NULL,
+    EXPR_SYMBOLIC,
+    EXPR_BOOL,
+    EXPR_BV,
+    EXPR_INT
+};
+
+/*
+ * Value handle for an expression.
+ * Concrete booleans, bitvectors of 1 to 64 bits and integers are stored inline,
+ * so creating, copying and inspecting them never touches the heap;
+ * symbolic terms store the index of their node instead.
+ * A default-constructed Expression is null.
+ */
 class Expression {
 public:
-    Expression() {}
-    virtual ~Expression() {}
+    Expression() : m_data(0), m_width(0), m_kind(EXPR_NULL) {}
+
+    static Expression mk_bool(bool val) { return Expression(val ? 1 : 0, 1, EXPR_BOOL); }
+    static Expression mk_bv(uint64_t val, uint8_t width) { return Expression(val & get_mask(width), width, EXPR_BV); }
+    static Expression mk_int(int32_t val) { return Expression((uint32_t)val, 32, EXPR_INT); }
+    static Expression mk_symbolic(uint32_t node, uint8_t width) { return Expression(node, width, EXPR_SYMBOLIC); }
 
-    virtual bool is_concrete() = 0;
+    bool is_null() const { return m_kind == EXPR_NULL; }
+    bool is_symbolic() const { return m_kind == EXPR_SYMBOLIC; }
+    bool is_concrete() const { return m_kind >= EXPR_BOOL; }
     /*
      * Note that if !is_concrete(), the return value is undefined.
      */
-    virtual uint32_t get_value() = 0;
-    virtual uint8_t get_width() = 0;
+    uint64_t get_value() const { return m_data; }
+    uint8_t get_width() const { return m_width; }
+    EExpressionKind get_kind() const { return (EExpressionKind)m_kind; }
+    // index of the node of a symbolic expression, or 0 otherwise
+    uint32_t get_node() const { return is_symbolic() ? (uint32_t)m_data : 0; }
+
+    bool operator==(const Expression & other) const {
+        return m_data == other.m_data && m_width == other.m_width && m_kind == other.m_kind;
+    }
+    bool operator!=(const Expression & other) const { return !(*this == other); }
+
+protected:
+    Expression(uint64_t data, uint8_t width, EExpressionKind kind) : m_data(data), m_width(width), m_kind(kind) {}
+
+    static uint64_t get_mask(uint8_t width) { return (width >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << width) - 1); }
 
-    virtual std::string to_string() const = 0;
+    uint64_t m_data; // value if concrete, node index if symbolic
+    uint8_t m_width;
+    uint8_t m_kind;
 };
 
 #endif // _EXPRESSION_H_
@@ -20,6 +20,8 @@ protected:
     void set_PRG_ROM_8(Context & ctx, int bank, int val);
     void set_PRG_ROM_16(Context & ctx, int bank, int val);
     void set_PRG_ROM_32(Context & ctx, int bank, int val);
+    void set_PRG_RAM_4(Context & ctx, int bank, int val);
+    void set_PRG_RAM_8(Context & ctx, int bank, int val);
 };
 
 Mapper * get_mapper(unsigned int mapper_id, uint8_t ines_flags);
@@ -0,0 +1,76 @@
+#ifndef _PAGED_RAM_H_
+#define _PAGED_RAM_H_
+
+#include <cstdint>
+#include <map>
+#include <unordered_set>
+#include <vector>
+#include "expression.h"
+#include "state_digest.h"
+
+class ASTManager;
+
+/*
+ * Byte-addressed memory whose cells hold concrete bytes or symbolic expressions,
+ * split into 256-byte pages that copies share until one of them writes.
+ * Copying is therefore O(1) in the size of the memory, and a read costs one
+ * indirection however many copies of copies there are.
+ */
+class PagedRAM {
+public:
+    // 'size' must be a multiple of PAGE_BYTES; every cell starts as concrete 0;
+    // 'domain' tells the cells of different memories apart in digests
+    explicit PagedRAM(uint32_t size, EDigestDomain domain = DIGEST_RAM);
+    PagedRAM(const PagedRAM & other);
+    PagedRAM & operator=(const PagedRAM & other);
+    ~PagedRAM();
+
+    static const uint32_t PAGE_BYTES = 0x100;
+
+    uint32_t get_size() const { return m_num_pages * PAGE_BYTES; }
+
+    Expression read(uint16_t addr) const;
+    void write(uint16_t addr, Expression value);
+
+    /*
+     * Digest of the contents, kept current by write(): every cell that does not hold concrete 0
+     * is an entry of its address and the identity of its value, so a write only swaps out the
+     * entry of one cell.
+     */
+    const StateDigest & get_digest() const { return m_digest; }
+    // append the expressions held by symbolic cells to 'values'
+    void collect_symbolic(std::vector<Expression> & values) const;
+
+    // append the addresses of the cells that differ from those of 'other', which must be as large,
+    // to 'addresses'; pages the two share are skipped, and the search stops with false once
+    // more than 'limit' cells differ
+    bool find_differences(const PagedRAM & other, std::vector<uint16_t> & addresses, size_t limit) const;
+
+    // for ASTManager::collect_garbage(): mark the expressions in symbolic cells as live, and later
+    // replace them by their relocated nodes; pages in 'visited' have been seen through a copy already
+    void mark_live(ASTManager & m, std::unordered_set<const void*> & visited) const;
+    void relocate(ASTManager & m, std::unordered_set<const void*> & visited);
+
+protected:
+    struct Page {
+        unsigned int references;
+        uint8_t bytes[PAGE_BYTES];
+        // cells whose bit is set hold the expression in 'symbolic_values' instead of their byte
+        uint64_t symbolic[PAGE_BYTES / 64];
+        std::map<uint8_t, Expression> symbolic_values;
+    };
+
+    uint32_t m_num_pages;
+    Page ** m_pages;
+    EDigestDomain m_domain;
+    StateDigest m_digest;
+
+    // toggle the entry of a cell holding 'value' in 'digest'
+    void toggle_cell(StateDigest & digest, uint16_t addr, Expression value) const;
+
+    static void release(Page * page);
+    // the page holding 'addr', copied first if it is shared
+    Page * get_writable_page(uint16_t addr);
+};
+
+#endif // _PAGED_RAM_H_
@@ -0,0 +1,74 @@
+#ifndef _PATH_CONDITION_H_
+#define _PATH_CONDITION_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+#include "expression.h"
+
+class ASTManager;
+
+/*
+ * An immutable conjunction of assumptions, stored as a reference-counted cons-list
+ * whose tail is shared by every path that extends it. Copying a path and extending
+ * it by one assumption are O(1); each cell also caches, for the whole path up to it,
+ * the number of assumptions, a hash and the set of variables mentioned, so none of
+ * them needs a walk along the list. Paths are created by ASTManager::extend_path(),
+ * which knows the variables of an assumption.
+ */
+class PathCondition {
+public:
+    // the empty path
+    PathCondition();
+    PathCondition(const PathCondition & other);
+    PathCondition & operator=(const PathCondition & other);
+    ~PathCondition();
+
+    bool empty() const { return m_cell == NULL; }
+    size_t size() const { return (m_cell == NULL) ? 0 : m_cell->count; }
+    // independent of the order of the assumptions
+    uint64_t get_hash() const { return (m_cell == NULL) ? 0 : m_cell->hash; }
+    // contribution of one assumption to the hash of a path; the hash is the sum over its assumptions
+    static uint64_t hash_assumption(Expression assumption);
+    // the most recent assumption; the path must not be empty
+    Expression back() const { return m_cell->assumption; }
+    // the path without its most recent assumption
+    PathCondition get_prefix() const;
+    // the longest path that both this path and 'other' extend
+    PathCondition get_common_prefix(const PathCondition & other) const;
+    // node indices of the variables in the path, sorted
+    const std::vector<uint32_t> & get_variables() const;
+    // whether any of the (sorted) 'variables' occurs in the path
+    bool mentions_any(const std::vector<uint32_t> & variables) const;
+    // append the assumptions to 'buffer', oldest first
+    void collect(std::vector<Expression> & buffer) const;
+
+    // this path and 'assumption', which mentions the (sorted) 'variables'
+    PathCondition extend(Expression assumption, const std::vector<uint32_t> & variables) const;
+
+    // for ASTManager::collect_garbage(): mark the assumptions and variables of the path as live,
+    // and later replace them by their relocated nodes. Paths share cells, so cells in 'visited'
+    // have been seen through another path already and are skipped, together with their prefix.
+    void mark_live(ASTManager & m, std::unordered_set<const void*> & visited) const;
+    void relocate(ASTManager & m, std::unordered_set<const void*> & visited);
+
+protected:
+    struct Cell {
+        Expression assumption;
+        Cell * prev;
+        unsigned int references;
+        uint32_t count;
+        uint64_t hash;
+        // shared with the previous cell when the assumption adds no variables
+        std::shared_ptr<const std::vector<uint32_t> > variables;
+    };
+
+    Cell * m_cell;
+
+    explicit PathCondition(Cell * cell);
+    static void release(Cell * cell);
+};
+
+#endif // _PATH_CONDITION_H_
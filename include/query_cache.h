@@ -0,0 +1,52 @@
+#ifndef _QUERY_CACHE_H_
+#define _QUERY_CACHE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include "solver_status.h"
+#include "model.h"
+
+/*
+ * Results of previous solver queries.
+ * A query is the conjunction of a set of boolean terms, identified by the
+ * sorted, duplicate-free list of their node indices. Besides exact repeats,
+ * a query is answered from the cache if
+ *   - some cached UNSAT query is a subset of it (adding constraints keeps it UNSAT), or
+ *   - some cached SAT query is a superset of it (the superset's model satisfies it too).
+ */
+class QueryCache {
+public:
+    QueryCache(size_t capacity = (1 << 14));
+
+    // returns SAT or UNSAT if the cache decides 'query', and UNKNOWN otherwise;
+    // if 'model' is not NULL, SAT is only returned when a model can be supplied
+    ESolverStatus lookup(const std::vector<uint32_t> & query, Model ** model);
+    // remember the result of 'query'; 'model' may be NULL
+    void insert(const std::vector<uint32_t> & query, ESolverStatus result, Model * model);
+    void clear();
+
+    uint64_t get_num_hits() const { return m_num_hits; }
+    uint64_t get_num_misses() const { return m_num_misses; }
+
+protected:
+    // whether an entry is SAT or UNSAT is given by the index it is listed in
+    struct Entry {
+        std::vector<uint32_t> assertions;
+        bool has_model;
+        Model model;
+    };
+    size_t m_capacity;
+    std::vector<Entry> m_entries;
+    // UNSAT entries by their smallest node index: any of them that is a subset
+    // of a query is found under one of the query's members
+    std::unordered_map<uint32_t, std::vector<uint32_t> > m_unsat_by_first;
+    // SAT entries by every node index they contain
+    std::unordered_map<uint32_t, std::vector<uint32_t> > m_sat_by_member;
+
+    uint64_t m_num_hits;
+    uint64_t m_num_misses;
+};
+
+#endif // _QUERY_CACHE_H_
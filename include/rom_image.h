@@ -0,0 +1,33 @@
+#ifndef _ROM_IMAGE_H_
+#define _ROM_IMAGE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * The bytes of an iNES image, kept for as long as the cartridge is in use.
+ * A file is mapped read-only rather than read, so every process exploring
+ * the same ROM shares one copy of it in the page cache; an image built in
+ * memory is adopted as it is. Either way, the cartridge's banks point
+ * straight into these bytes.
+ */
+class RomImage {
+public:
+    // map 'filename' read-only; throws if the file cannot be mapped
+    static RomImage * map_file(const char * filename);
+    // take ownership of 'size' bytes allocated with new[]
+    static RomImage * adopt_buffer(uint8_t * data, size_t size);
+    ~RomImage();
+
+    const uint8_t * get_data() const;
+    size_t get_size() const;
+
+protected:
+    RomImage(uint8_t * data, size_t size, bool mapped);
+
+    uint8_t * m_data;
+    size_t m_size;
+    bool m_mapped; // unmapped rather than deleted
+};
+
+#endif // _ROM_IMAGE_H_
@@ -0,0 +1,127 @@
+#ifndef _SAT_SOLVER_H_
+#define _SAT_SOLVER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * A literal is encoded as 2 * variable + sign,
+ * so negating a literal flips its lowest bit.
+ */
+typedef uint32_t Literal;
+
+static inline Literal mk_literal(uint32_t var, bool negated) { return (var << 1) | (negated ? 1 : 0); }
+static inline Literal negate(Literal lit) { return lit ^ 1; }
+static inline uint32_t literal_var(Literal lit) { return lit >> 1; }
+static inline bool literal_sign(Literal lit) { return (lit & 1) != 0; }
+
+enum ESATResult {
+    SAT_RESULT_SAT,
+    SAT_RESULT_UNSAT,
+    SAT_RESULT_UNKNOWN
+};
+
+/*
+ * A small conflict-driven clause-learning SAT solver:
+ * two watched literals, first-UIP learning, VSIDS branching with phase saving,
+ * Luby restarts and activity-based deletion of learnt clauses.
+ * Clauses may only be added while the solver is not searching.
+ * The solver is incremental: clauses, learnt clauses and activities persist
+ * across calls to solve(), and each call may assume additional literals.
+ */
+class SATSolver {
+public:
+    SATSolver();
+    ~SATSolver();
+
+    uint32_t new_var();
+    uint32_t get_num_vars() const { return m_assigns.size(); }
+    // returns false if the clause set has become unsatisfiable
+    bool add_clause(std::vector<Literal> lits);
+    // decide the clause set under the given assumed literals;
+    // SAT_RESULT_UNKNOWN if the budget runs out first
+    ESATResult solve(const std::vector<Literal> & assumptions);
+    ESATResult solve() { return solve(std::vector<Literal>()); }
+    // limit each later call to solve() to this many conflicts and milliseconds (0 = unlimited);
+    // the limits are checked at restarts
+    void set_budget(uint64_t max_conflicts, unsigned int max_milliseconds) {
+        m_max_conflicts = max_conflicts;
+        m_max_milliseconds = max_milliseconds;
+    }
+    // value of 'var' in the model found by the last successful solve()
+    bool get_model_value(uint32_t var) const { return m_model[var]; }
+
+    uint64_t get_num_conflicts() const { return m_num_conflicts; }
+    uint64_t get_num_decisions() const { return m_num_decisions; }
+    uint64_t get_num_propagations() const { return m_num_propagations; }
+
+protected:
+    struct Clause {
+        bool learnt;
+        double activity;
+        std::vector<Literal> lits; // for a reason clause, lits[0] is the implied literal
+    };
+
+    bool m_ok; // false once the clause set is known to be unsatisfiable
+    std::vector<Clause*> m_clauses;
+    std::vector<Clause*> m_learnts;
+    std::vector<std::vector<Clause*> > m_watches; // clauses watching each literal
+
+    // per-variable state
+    std::vector<int8_t> m_assigns; // 1 = true, -1 = false, 0 = unassigned
+    std::vector<uint32_t> m_levels;
+    std::vector<Clause*> m_reasons;
+    std::vector<bool> m_polarity; // last assigned value
+    std::vector<double> m_activity;
+    std::vector<bool> m_seen;
+    std::vector<bool> m_model;
+
+    std::vector<Literal> m_trail;
+    std::vector<size_t> m_trail_lim; // start of each decision level in the trail
+    size_t m_qhead;
+    std::vector<Literal> m_assumptions; // decided first, one per decision level
+
+    double m_var_inc;
+    double m_clause_inc;
+    size_t m_max_learnts;
+
+    // binary max-heap of variables ordered by activity
+    std::vector<uint32_t> m_heap;
+    std::vector<int> m_heap_index; // -1 if not in the heap
+
+    uint64_t m_max_conflicts;
+    unsigned int m_max_milliseconds;
+
+    uint64_t m_num_conflicts;
+    uint64_t m_num_decisions;
+    uint64_t m_num_propagations;
+
+    int8_t value(Literal lit) const {
+        int8_t v = m_assigns[literal_var(lit)];
+        return literal_sign(lit) ? -v : v;
+    }
+    uint32_t decision_level() const { return m_trail_lim.size(); }
+
+    void enqueue(Literal lit, Clause * reason);
+    Clause * propagate();
+    void analyze(Clause * conflict, std::vector<Literal> & learnt, uint32_t & backtrack_level);
+    void cancel_until(uint32_t level);
+    bool pick_branch(Literal & lit);
+    ESATResult search(uint64_t conflict_limit);
+
+    void attach(Clause * c);
+    void detach(Clause * c);
+    bool is_locked(Clause * c) const;
+    void reduce_learnts();
+
+    void bump_var(uint32_t var);
+    void bump_clause(Clause * c);
+
+    void heap_insert(uint32_t var);
+    void heap_up(size_t i);
+    void heap_down(size_t i);
+    uint32_t heap_pop();
+};
+
+#endif // _SAT_SOLVER_H_
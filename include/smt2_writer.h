@@ -0,0 +1,48 @@
+#ifndef _SMT2_WRITER_H_
+#define _SMT2_WRITER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <ostream>
+
+/*
+ * Buffered output sink for SMT-LIB2 text.
+ * Text is either appended to a string or written straight to a file descriptor
+ * (e.g. the solver's input pipe) whenever the buffer fills up.
+ */
+class SMT2Writer {
+public:
+    SMT2Writer(int fd);
+    SMT2Writer(std::string & out);
+    ~SMT2Writer();
+
+    void write(const char * str);
+    void write(const char * data, size_t len);
+    void write(const std::string & str) { write(str.data(), str.size()); }
+    void write(char c) {
+        if (m_pos == sizeof(m_buffer)) {
+            flush();
+        }
+        m_buffer[m_pos++] = c;
+    }
+    void write_uint(uint64_t val);
+
+    // also copy everything written to 'echo', e.g. for tracing
+    void set_echo(std::ostream * echo);
+
+    void flush();
+
+protected:
+    int m_fd;
+    std::string * m_out;
+    std::ostream * m_echo;
+    char m_buffer[1 << 16];
+    size_t m_pos;
+
+private:
+    SMT2Writer(const SMT2Writer &);
+    SMT2Writer & operator=(const SMT2Writer &);
+};
+
+#endif // _SMT2_WRITER_H_
@@ -0,0 +1,48 @@
+#ifndef _SOLVER_COMMAND_H_
+#define _SOLVER_COMMAND_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "solver_status.h"
+#include "model.h"
+
+// how a solver reports a satisfying assignment
+enum EModelFormat {
+    MODEL_FORMAT_SMTLIB2, // answers (get-model) with (define-fun ...) entries
+    MODEL_FORMAT_STP      // prints ASSERT( var = value ); lines with --print-counterex
+};
+
+/*
+ * How to run an external SMT-LIB2 solver that reads its instance from standard input.
+ */
+struct SolverCommand {
+    std::string name;
+    std::vector<std::string> arguments; // arguments[0] is the program, looked up in PATH
+    std::vector<std::string> model_arguments; // appended when a model is wanted
+    EModelFormat model_format;
+
+    // the solvers we know how to drive, by name (stp, z3, cvc4, cvc5, yices);
+    // returns false for an unknown name
+    static bool lookup(const std::string & name, SolverCommand & command);
+
+    /*
+     * Start the solver with its standard input and output connected to pipes.
+     * Our ends of the pipes are returned in 'input' and 'output' and are not
+     * inherited by other child processes. If 'memory_limit' is not 0, the solver's
+     * address space is limited to that many bytes. Returns -1 on failure.
+     */
+    pid_t spawn(bool want_model, uint64_t memory_limit, int & input, int & output) const;
+
+    // text sent before and after the assertions of a one-shot instance
+    std::string get_prologue(bool want_model) const;
+    std::string get_epilogue(bool want_model) const;
+
+    // the sat/unsat/unknown answer in a complete response; ERROR if there is none
+    static ESolverStatus parse_status(const std::string & response);
+    // add the assignment in a complete 'sat' response to 'model'; returns false if it cannot be parsed
+    bool parse_model(const std::string & response, Model & model) const;
+};
+
+#endif // _SOLVER_COMMAND_H_
@@ -0,0 +1,41 @@
+#ifndef _SOLVER_POOL_H_
+#define _SOLVER_POOL_H_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include "solver_status.h"
+
+/*
+ * A fixed set of worker threads that run solver jobs in the order they were submitted.
+ * Jobs must not touch the ASTManager; they get everything they need (e.g. the text
+ * of the instance) when they are created.
+ */
+class SolverPool {
+public:
+    SolverPool(unsigned int num_workers);
+    // jobs that have not started yet are dropped, and their futures report a broken promise
+    ~SolverPool();
+
+    std::future<ESolverStatus> submit(std::function<ESolverStatus()> job);
+    unsigned int get_num_workers() const { return m_workers.size(); }
+
+protected:
+    std::vector<std::thread> m_workers;
+    std::deque<std::packaged_task<ESolverStatus()> > m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_job_available;
+    bool m_stopping;
+
+    void run_worker();
+
+private:
+    SolverPool(const SolverPool &);
+    SolverPool & operator=(const SolverPool &);
+};
+
+#endif // _SOLVER_POOL_H_
@@ -0,0 +1,35 @@
+#ifndef _SOLVER_STATUS_H_
+#define _SOLVER_STATUS_H_
+
+#include <climits>
+#include <cstdint>
+
+enum ESolverStatus {
+    SAT,
+    UNSAT,
+    UNKNOWN,
+    ERROR
+};
+
+/*
+ * Resources that deciding one query may use; 0 means unlimited.
+ * A backend that runs out answers UNKNOWN.
+ */
+struct SolverLimits {
+    unsigned int timeout_ms; // wall-clock time
+    uint64_t memory_bytes;   // address space of each external solver process
+    uint64_t conflicts;      // conflicts of the in-process SAT solver
+
+    SolverLimits() : timeout_ms(0), memory_bytes(0), conflicts(0) {}
+
+    // the same limits, 'factor' times as generous; a limit that would overflow becomes unlimited
+    SolverLimits scaled(unsigned int factor) const {
+        SolverLimits limits(*this);
+        limits.timeout_ms = (timeout_ms > UINT_MAX / factor) ? 0 : timeout_ms * factor;
+        limits.memory_bytes = (memory_bytes > UINT64_MAX / factor) ? 0 : memory_bytes * factor;
+        limits.conflicts = (conflicts > UINT64_MAX / factor) ? 0 : conflicts * factor;
+        return limits;
+    }
+};
+
+#endif // _SOLVER_STATUS_H_
@@ -0,0 +1,56 @@
+#ifndef _STATE_DIGEST_H_
+#define _STATE_DIGEST_H_
+
+#include <cstdint>
+#include <cstddef>
+
+// spread the bits of 'x' over the whole word (the splitmix64 finaliser)
+inline uint64_t mix_hash(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// what the key of a digest entry identifies; keys of different domains never hash alike
+enum EDigestDomain {
+    DIGEST_RAM = 1,   // key: cell address
+    DIGEST_STATE = 2, // key: element of the machine state outside RAM
+    DIGEST_PATH = 3,
+    DIGEST_PRG_RAM = 4 // key: cell address in cartridge RAM
+};
+
+/*
+ * Zobrist-style digest of a set of (key, value) entries: every entry contributes a hash
+ * of its domain, key and value, and the contributions are combined with xor, so toggling
+ * an entry in and out again leaves the digest as it was and updates cost O(1).
+ * The two halves are computed independently, so that equal digests are strong
+ * evidence of equal contents rather than a 64-bit coincidence.
+ */
+struct StateDigest {
+    uint64_t first;
+    uint64_t second;
+
+    StateDigest() : first(0), second(0) {}
+
+    // add the entry if it is absent, remove it if it is present; keys must fit in 56 bits
+    void toggle(EDigestDomain domain, uint64_t key, uint64_t value) {
+        uint64_t tagged = ((uint64_t)domain << 56) | key;
+        first ^= mix_hash(value ^ mix_hash(tagged));
+        second ^= mix_hash(value + mix_hash(tagged ^ 0xD6E8FEB86659FD93ULL));
+    }
+
+    StateDigest & operator^=(const StateDigest & other) {
+        first ^= other.first;
+        second ^= other.second;
+        return *this;
+    }
+    bool operator==(const StateDigest & other) const { return first == other.first && second == other.second; }
+    bool operator!=(const StateDigest & other) const { return !(*this == other); }
+};
+
+struct StateDigestHash {
+    size_t operator()(const StateDigest & digest) const { return (size_t)digest.first; }
+};
+
+#endif // _STATE_DIGEST_H_
@@ -0,0 +1,68 @@
+#include "arena.h"
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+// every allocation is aligned to this many bytes
+#define ARENA_ALIGNMENT (alignof(std::max_align_t))
+
+Arena::Arena(size_t slab_size)
+: m_slab_size(slab_size), m_cursor(NULL), m_limit(NULL),
+  m_bytes_allocated(0), m_bytes_reserved(0) {}
+
+Arena::~Arena() {
+    release();
+}
+
+void * Arena::allocate(size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    if (m_cursor == NULL || (size_t)(m_limit - m_cursor) < size) {
+        new_slab(size);
+    }
+    void * ptr = m_cursor;
+    m_cursor += size;
+    m_bytes_allocated += size;
+    return ptr;
+}
+
+void Arena::release() {
+    for (std::vector<char*>::iterator it = m_slabs.begin(); it != m_slabs.end(); ++it) {
+        free(*it);
+    }
+    m_slabs.clear();
+    m_cursor = NULL;
+    m_limit = NULL;
+    m_bytes_allocated = 0;
+    m_bytes_reserved = 0;
+}
+
+void Arena::swap(Arena & other) {
+    std::swap(m_slab_size, other.m_slab_size);
+    m_slabs.swap(other.m_slabs);
+    std::swap(m_cursor, other.m_cursor);
+    std::swap(m_limit, other.m_limit);
+    std::swap(m_bytes_allocated, other.m_bytes_allocated);
+    std::swap(m_bytes_reserved, other.m_bytes_reserved);
+}
+
+size_t Arena::get_bytes_allocated() const {
+    return m_bytes_allocated;
+}
+
+size_t Arena::get_bytes_reserved() const {
+    return m_bytes_reserved;
+}
+
+void Arena::new_slab(size_t min_size) {
+    // oversized requests get a slab of their own
+    size_t size = (min_size > m_slab_size) ? min_size : m_slab_size;
+    char * slab = (char*)malloc(size);
+    if (slab == NULL) {
+        throw std::bad_alloc();
+    }
+    m_slabs.push_back(slab);
+    m_cursor = slab;
+    m_limit = slab + size;
+    m_bytes_reserved += size;
+}
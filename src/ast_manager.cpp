@@ -1,6 +1,37 @@
 #include "ast_manager.h"
+#include "trace.h"
+#include <cstring>
+#include <algorithm>
 
-Expression * ASTManager::mk_var(unsigned int nBits) {
+// initial number of slots in the hash-consing table; always a power of two
+#define NODE_TABLE_INITIAL_SIZE (1 << 12)
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline size_t hash_node(const ExpressionNode & node) {
+    uint64_t words[2];
+    memcpy(words, &node, sizeof(words));
+    return (size_t)mix64(words[0] ^ mix64(words[1]));
+}
+
+static inline bool nodes_equal(const ExpressionNode & lhs, const ExpressionNode & rhs) {
+    return memcmp(&lhs, &rhs, sizeof(ExpressionNode)) == 0;
+}
+
+ASTManager::ASTManager() : m_varID(0), m_num_nodes(0), m_node_table_entries(0), m_eval_current_epoch(1) {
+    reset_node_table();
+}
+
+ASTManager::~ASTManager() {}
+
+Expression ASTManager::mk_var(unsigned int nBits) {
     return mk_var(get_unique_variable_name(), nBits);
 }
 
@@ -9,3 +40,612 @@ std::string ASTManager::get_unique_variable_name() {
     m_varID += 1;
     return name;
 }
+
+const std::string & ASTManager::get_variable_name(uint32_t id) const {
+    return m_variable_names.at(get_node(id).args[0]);
+}
+
+Expression ASTManager::get_expression(uint32_t id) const {
+    const ExpressionNode & node = get_node(id);
+    switch (node.op) {
+    case OP_BOOL_CONST:
+        return Expression::mk_bool(node.args[0] != 0);
+    case OP_BV_CONST:
+        return Expression::mk_bv(((uint64_t)node.args[1] << 32) | node.args[0], node.width);
+    case OP_INT_CONST:
+        return Expression::mk_int((int32_t)node.args[0]);
+    default:
+        return Expression::mk_symbolic(id, node.width);
+    }
+}
+
+bool ASTManager::is_boolean(Expression expr) const {
+    if (!expr.is_symbolic()) {
+        return expr.get_kind() == EXPR_BOOL;
+    }
+    uint32_t id = expr.get_node();
+    while (true) {
+        const ExpressionNode & node = get_node(id);
+        switch (node.op) {
+        case OP_BOOL_CONST:
+        case OP_AND: case OP_OR: case OP_NOT: case OP_EQ:
+        case OP_BV_ULT: case OP_BV_ULE: case OP_BV_UGT: case OP_BV_UGE:
+        case OP_BV_SLT: case OP_BV_SLE: case OP_BV_SGT: case OP_BV_SGE:
+            return true;
+        case OP_ITE:
+            // both branches have the same sort
+            id = node.args[1];
+            break;
+        default:
+            return false;
+        }
+    }
+}
+
+const std::vector<uint32_t> & ASTManager::get_assertion_variables(uint32_t root) {
+    std::unordered_map<uint32_t, std::vector<uint32_t> >::iterator it = m_assertion_variables.find(root);
+    if (it != m_assertion_variables.end()) {
+        return it->second;
+    }
+    std::vector<uint32_t> & variables = m_assertion_variables[root];
+    // most assertions are small; don't pay for a visited flag per node in the table
+    std::unordered_set<uint32_t> visited;
+    std::vector<uint32_t> stack;
+    stack.push_back(root);
+    while (!stack.empty()) {
+        uint32_t id = stack.back();
+        stack.pop_back();
+        if (!visited.insert(id).second) {
+            continue;
+        }
+        const ExpressionNode & node = get_node(id);
+        if (node.op == OP_VAR) {
+            variables.push_back(id);
+        }
+        for (unsigned int i = 0; i < node.num_args; ++i) {
+            if (get_node(node.args[i]).flags & NODE_SYMBOLIC) {
+                stack.push_back(node.args[i]);
+            }
+        }
+    }
+    std::sort(variables.begin(), variables.end());
+    return variables;
+}
+
+static uint32_t find_cluster(std::vector<uint32_t> & parent, uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void ASTManager::slice_path(std::vector<Expression> & path, const std::vector<Expression> & terms, std::vector<Expression> & slice) {
+    // union-find over the assertions; the terms are all number path.size()
+    std::vector<uint32_t> parent(path.size() + 1);
+    for (uint32_t i = 0; i < parent.size(); ++i) {
+        parent[i] = i;
+    }
+    // first assertion seen to mention each variable
+    std::unordered_map<uint32_t, uint32_t> owner;
+    for (uint32_t i = 0; i < path.size() + terms.size(); ++i) {
+        Expression assertion = (i < path.size()) ? path[i] : terms[i - path.size()];
+        uint32_t self = (i < path.size()) ? i : path.size();
+        if (!assertion.is_symbolic()) {
+            continue;
+        }
+        const std::vector<uint32_t> & variables = get_assertion_variables(assertion.get_node());
+        for (std::vector<uint32_t>::const_iterator v = variables.begin(); v != variables.end(); ++v) {
+            std::pair<std::unordered_map<uint32_t, uint32_t>::iterator, bool> entry = owner.insert(std::make_pair(*v, self));
+            if (!entry.second) {
+                parent[find_cluster(parent, self)] = find_cluster(parent, entry.first->second);
+            }
+        }
+    }
+    uint32_t cluster = find_cluster(parent, path.size());
+    for (uint32_t i = 0; i < path.size(); ++i) {
+        if (find_cluster(parent, i) == cluster) {
+            slice.push_back(path[i]);
+        }
+    }
+}
+
+bool ASTManager::prepare_query(std::vector<Expression> & full_path, Expression condition, Model ** model,
+        SolverQuery & query, ESolverStatus & result) {
+    // the path is satisfiable on its own, so only the assertions that are connected to the
+    // condition through shared variables can make the query unsatisfiable;
+    // a model, however, has to cover every variable
+    query.path.clear();
+    query.ids.clear();
+    query.condition = condition;
+    if (model == NULL && condition.is_symbolic()) {
+        slice_path(full_path, std::vector<Expression>(1, condition), query.path);
+        TRACE("solver", tout << "condition depends on " << query.path.size() << " of " << full_path.size() << " path assertions" << std::endl;);
+    } else {
+        query.path = full_path;
+    }
+
+    // the query is identified by the set of nodes it asserts
+    query.ids.reserve(query.path.size() + 1);
+    for (size_t i = 0; i <= query.path.size(); ++i) {
+        Expression assertion = (i < query.path.size()) ? query.path[i] : condition;
+        if (assertion.is_symbolic()) {
+            query.ids.push_back(assertion.get_node());
+        } else if (assertion.is_concrete() && assertion.get_value() == 0) {
+            TRACE("solver", tout << "query contains a constant false assertion" << std::endl;);
+            result = UNSAT;
+            return true;
+        }
+    }
+    if (query.ids.empty()) {
+        return false;
+    }
+    std::sort(query.ids.begin(), query.ids.end());
+    query.ids.erase(std::unique(query.ids.begin(), query.ids.end()), query.ids.end());
+
+    result = m_query_cache.lookup(query.ids, model);
+    if (result == SAT || result == UNSAT) {
+        TRACE("solver", tout << "query cache hit: " << (result == SAT ? "sat" : "unsat")
+              << " (" << m_query_cache.get_num_hits() << " hits, "
+              << m_query_cache.get_num_misses() << " misses)" << std::endl;);
+        return true;
+    }
+    if (find_model(query.ids, model)) {
+        m_query_cache.insert(query.ids, SAT, (model != NULL) ? *model : NULL);
+        result = SAT;
+        return true;
+    }
+    // small input domains are cheaper to search exhaustively than to solve
+    std::vector<uint64_t> assignment;
+    result = enumerate(query.ids, assignment);
+    if (result == SAT || result == UNSAT) {
+        TRACE("solver", tout << "decided by enumeration: " << (result == SAT ? "sat" : "unsat") << std::endl;);
+        if (result == SAT) {
+            if (model != NULL) {
+                assignment_to_model(query.ids, assignment, **model);
+            }
+            remember_model(assignment);
+        }
+        m_query_cache.insert(query.ids, result, (model != NULL) ? *model : NULL);
+        return true;
+    }
+    return false;
+}
+
+ESolverStatus ASTManager::solve_query(SolverQuery & query, Model ** model) {
+    // ask for a model anyway if it is cheap, so that later queries can reuse it
+    Model local_model;
+    Model * local_model_ptr = &local_model;
+    Model ** solver_model = model;
+    if (solver_model == NULL && has_cheap_models()) {
+        solver_model = &local_model_ptr;
+    }
+    m_active_limits = m_query_limits.scaled(query.effort);
+    ESolverStatus result = solve_assuming(query.path, query.condition, solver_model);
+    m_active_limits = m_query_limits;
+    if (result == SAT && solver_model != NULL) {
+        remember_model(query.ids, **solver_model);
+    }
+    m_query_cache.insert(query.ids, result, (model != NULL) ? *model : NULL);
+    return result;
+}
+
+ESolverStatus ASTManager::check_assuming(std::vector<Expression> & path, Expression condition, Model ** model) {
+    SolverQuery query;
+    ESolverStatus result;
+    if (prepare_query(path, condition, model, query, result)) {
+        return result;
+    }
+    return solve_query(query, model);
+}
+
+static std::shared_future<ESolverStatus> mk_ready_future(ESolverStatus result) {
+    std::promise<ESolverStatus> answer;
+    answer.set_value(result);
+    return answer.get_future().share();
+}
+
+void ASTManager::check_assuming_async(std::vector<Expression> & path, Expression condition, PendingQuery & pending,
+        unsigned int effort) {
+    ESolverStatus result;
+    pending.m_recorded = true;
+    pending.m_query.effort = effort;
+    if (prepare_query(path, condition, NULL, pending.m_query, result)) {
+        pending.m_answer = mk_ready_future(result);
+    } else if (submit_query(pending.m_query, pending.m_answer)) {
+        pending.m_recorded = false;
+    } else {
+        // the backend cannot work in the background; answer right away
+        pending.m_answer = mk_ready_future(solve_query(pending.m_query, NULL));
+    }
+}
+
+void ASTManager::check_assuming_async(const PathCondition & path, Expression condition, PendingQuery & pending,
+        unsigned int effort) {
+    std::vector<Expression> assumptions;
+    // the path is satisfiable, so if the condition shares no variables with it, the slice is
+    // empty; the path's cached variable set tells without looking at a single assumption
+    if (!condition.is_symbolic() || path.mentions_any(get_assertion_variables(condition.get_node()))) {
+        path.collect(assumptions);
+    } else if (!path.empty()) {
+        TRACE("solver", tout << "condition is independent of all " << path.size() << " path assertions" << std::endl;);
+    }
+    check_assuming_async(assumptions, condition, pending, effort);
+}
+
+PathCondition ASTManager::extend_path(const PathCondition & path, Expression assumption) {
+    if (!assumption.is_symbolic()) {
+        return path.extend(assumption, std::vector<uint32_t>());
+    }
+    return path.extend(assumption, get_assertion_variables(assumption.get_node()));
+}
+
+ESolverStatus ASTManager::get_result(PendingQuery & pending) {
+    ESolverStatus result = pending.m_answer.get();
+    if (!pending.m_recorded) {
+        m_query_cache.insert(pending.m_query.ids, result, NULL);
+        pending.m_recorded = true;
+    }
+    return result;
+}
+
+bool ASTManager::submit_query(SolverQuery &, std::shared_future<ESolverStatus> &) {
+    return false;
+}
+
+ESolverStatus ASTManager::solve_assuming(std::vector<Expression> & path, Expression condition, Model ** model) {
+    std::vector<Expression> assertions(path);
+    assertions.push_back(condition);
+    return call_solver(assertions, model);
+}
+
+void ASTManager::release_expressions() {
+    drop_node_references();
+    // models are indexed by variable name, and the names go as well
+    m_recent_models.clear();
+    reset_node_table();
+}
+
+void ASTManager::drop_node_references() {
+    // cached queries refer to node indices that are about to be reused
+    m_query_cache.clear();
+    m_assertion_variables.clear();
+    m_eval_values.clear();
+    m_eval_epoch.clear();
+}
+
+void ASTManager::begin_collection() {
+    m_forwarding.assign(m_num_nodes, 0);
+}
+
+void ASTManager::mark_live(Expression expr) {
+    if (expr.is_symbolic()) {
+        m_forwarding[expr.get_node()] = 1;
+    }
+}
+
+void ASTManager::mark_live_node(uint32_t id) {
+    m_forwarding[id] = 1;
+}
+
+void ASTManager::mark_live(const PendingQuery & pending) {
+    for (size_t i = 0; i < pending.m_query.path.size(); ++i) {
+        mark_live(pending.m_query.path[i]);
+    }
+    mark_live(pending.m_query.condition);
+    for (size_t i = 0; i < pending.m_query.ids.size(); ++i) {
+        mark_live_node(pending.m_query.ids[i]);
+    }
+}
+
+void ASTManager::collect_garbage() {
+    drop_node_references();
+    // children always have smaller indices than their parents, so one sweep downwards
+    // marks everything the marked nodes are built from
+    for (uint32_t id = m_num_nodes - 1; id > 0; --id) {
+        if (m_forwarding[id] == 0) {
+            continue;
+        }
+        const ExpressionNode & node = get_node(id);
+        for (unsigned int i = 0; i < node.num_args; ++i) {
+            m_forwarding[node.args[i]] = 1;
+        }
+    }
+    // copy the marked nodes upwards into fresh chunks, so that children still come first;
+    // index 0 stays reserved
+    Arena arena;
+    std::vector<ExpressionNode*> chunks;
+    uint32_t num_nodes = 0;
+    for (uint32_t id = 0; id < m_num_nodes; ++id) {
+        if (id != 0 && m_forwarding[id] == 0) {
+            continue;
+        }
+        if ((num_nodes & (NODE_CHUNK_SIZE - 1)) == 0) {
+            chunks.push_back((ExpressionNode*)arena.allocate(sizeof(ExpressionNode) * NODE_CHUNK_SIZE));
+        }
+        ExpressionNode node = get_node(id);
+        for (unsigned int i = 0; i < node.num_args; ++i) {
+            node.args[i] = m_forwarding[node.args[i]];
+        }
+        chunks[num_nodes >> NODE_CHUNK_BITS][num_nodes & (NODE_CHUNK_SIZE - 1)] = node;
+        m_forwarding[id] = num_nodes;
+        num_nodes += 1;
+    }
+    TRACE("gc", tout << "kept " << (num_nodes - 1) << " of " << (m_num_nodes - 1) << " expression nodes" << std::endl;);
+    // the old chunks are freed along with the local arena
+    m_arena.swap(arena);
+    m_node_chunks.swap(chunks);
+    m_num_nodes = num_nodes;
+
+    size_t table_size = NODE_TABLE_INITIAL_SIZE;
+    while (table_size < (size_t)m_num_nodes * 2) {
+        table_size *= 2;
+    }
+    m_node_table.assign(table_size, 0);
+    size_t mask = table_size - 1;
+    for (uint32_t id = 1; id < m_num_nodes; ++id) {
+        size_t slot = hash_node(get_node(id)) & mask;
+        while (m_node_table[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        m_node_table[slot] = id;
+    }
+    m_node_table_entries = m_num_nodes - 1;
+}
+
+Expression ASTManager::relocate(Expression expr) const {
+    if (!expr.is_symbolic()) {
+        return expr;
+    }
+    return Expression::mk_symbolic(m_forwarding[expr.get_node()], expr.get_width());
+}
+
+uint32_t ASTManager::relocate_node(uint32_t id) const {
+    return m_forwarding[id];
+}
+
+void ASTManager::relocate(PendingQuery & pending) const {
+    for (size_t i = 0; i < pending.m_query.path.size(); ++i) {
+        pending.m_query.path[i] = relocate(pending.m_query.path[i]);
+    }
+    pending.m_query.condition = relocate(pending.m_query.condition);
+    for (size_t i = 0; i < pending.m_query.ids.size(); ++i) {
+        pending.m_query.ids[i] = m_forwarding[pending.m_query.ids[i]];
+    }
+}
+
+void ASTManager::reset_node_table() {
+    m_node_chunks.clear();
+    m_arena.release();
+    m_node_table.assign(NODE_TABLE_INITIAL_SIZE, 0);
+    m_node_table_entries = 0;
+    m_variable_names.clear();
+    m_variable_ids.clear();
+    // reserve index 0 so that it never refers to a valid node
+    ExpressionNode * chunk = (ExpressionNode*)m_arena.allocate(sizeof(ExpressionNode) * NODE_CHUNK_SIZE);
+    memset(&chunk[0], 0, sizeof(ExpressionNode));
+    m_node_chunks.push_back(chunk);
+    m_num_nodes = 1;
+}
+
+uint32_t ASTManager::mk_node(const ExpressionNode & node) {
+    size_t mask = m_node_table.size() - 1;
+    size_t slot = hash_node(node) & mask;
+    while (m_node_table[slot] != 0) {
+        uint32_t id = m_node_table[slot];
+        if (nodes_equal(get_node(id), node)) {
+            return id;
+        }
+        slot = (slot + 1) & mask;
+    }
+    // not found; append a new node
+    if ((m_num_nodes & (NODE_CHUNK_SIZE - 1)) == 0) {
+        m_node_chunks.push_back((ExpressionNode*)m_arena.allocate(sizeof(ExpressionNode) * NODE_CHUNK_SIZE));
+    }
+    uint32_t id = m_num_nodes;
+    m_num_nodes += 1;
+    m_node_chunks[id >> NODE_CHUNK_BITS][id & (NODE_CHUNK_SIZE - 1)] = node;
+    m_node_table[slot] = id;
+    m_node_table_entries += 1;
+    if (m_node_table_entries * 2 > m_node_table.size()) {
+        grow_node_table();
+    }
+    return id;
+}
+
+void ASTManager::grow_node_table() {
+    std::vector<uint32_t> table(m_node_table.size() * 2, 0);
+    size_t mask = table.size() - 1;
+    for (std::vector<uint32_t>::iterator it = m_node_table.begin(); it != m_node_table.end(); ++it) {
+        if (*it == 0) {
+            continue;
+        }
+        size_t slot = hash_node(get_node(*it)) & mask;
+        while (table[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        table[slot] = *it;
+    }
+    m_node_table.swap(table);
+}
+
+uint32_t ASTManager::to_node(Expression expr) {
+    ExpressionNode node;
+    memset(&node, 0, sizeof(node));
+    node.width = expr.get_width();
+    node.args[0] = (uint32_t)expr.get_value();
+    node.args[1] = (uint32_t)(expr.get_value() >> 32);
+    switch (expr.get_kind()) {
+    case EXPR_SYMBOLIC:
+        return expr.get_node();
+    case EXPR_BOOL:
+        node.op = OP_BOOL_CONST;
+        break;
+    case EXPR_BV:
+        node.op = OP_BV_CONST;
+        break;
+    case EXPR_INT:
+        node.op = OP_INT_CONST;
+        break;
+    default:
+        throw "null expression used as an operand";
+    }
+    return mk_node(node);
+}
+
+// width of the result of applying 'op' to operands of the given widths
+static uint8_t get_result_width(EOpcode op, uint8_t width0, uint8_t width1) {
+    switch (op) {
+    case OP_AND: case OP_OR: case OP_NOT: case OP_EQ:
+    case OP_BV_ULT: case OP_BV_ULE: case OP_BV_UGT: case OP_BV_UGE:
+    case OP_BV_SLT: case OP_BV_SLE: case OP_BV_SGT: case OP_BV_SGE:
+        return 1;
+    case OP_ASSERT:
+        return 0;
+    case OP_BV_CONCAT:
+        return width0 + width1;
+    case OP_ITE:
+        return width1;
+    default:
+        return width0;
+    }
+}
+
+Expression ASTManager::mk_app(EOpcode op, Expression arg) {
+    ExpressionNode node;
+    memset(&node, 0, sizeof(node));
+    node.op = op;
+    node.width = get_result_width(op, arg.get_width(), 0);
+    node.flags = arg.is_symbolic() ? NODE_SYMBOLIC : 0;
+    node.num_args = 1;
+    node.args[0] = to_node(arg);
+    return Expression::mk_symbolic(mk_node(node), node.width);
+}
+
+Expression ASTManager::mk_app(EOpcode op, Expression arg0, Expression arg1) {
+    ExpressionNode node;
+    memset(&node, 0, sizeof(node));
+    node.op = op;
+    node.width = get_result_width(op, arg0.get_width(), arg1.get_width());
+    node.flags = (arg0.is_symbolic() || arg1.is_symbolic()) ? NODE_SYMBOLIC : 0;
+    node.num_args = 2;
+    node.args[0] = to_node(arg0);
+    node.args[1] = to_node(arg1);
+    return Expression::mk_symbolic(mk_node(node), node.width);
+}
+
+Expression ASTManager::mk_app(EOpcode op, Expression arg0, Expression arg1, Expression arg2) {
+    ExpressionNode node;
+    memset(&node, 0, sizeof(node));
+    node.op = op;
+    node.width = get_result_width(op, arg0.get_width(), arg1.get_width());
+    node.flags = (arg0.is_symbolic() || arg1.is_symbolic() || arg2.is_symbolic()) ? NODE_SYMBOLIC : 0;
+    node.num_args = 3;
+    node.args[0] = to_node(arg0);
+    node.args[1] = to_node(arg1);
+    node.args[2] = to_node(arg2);
+    return Expression::mk_symbolic(mk_node(node), node.width);
+}
+
+Expression ASTManager::mk_extract_app(Expression bv, uint32_t hi, uint32_t lo) {
+    ExpressionNode node;
+    memset(&node, 0, sizeof(node));
+    node.op = OP_BV_EXTRACT;
+    node.width = hi - lo + 1;
+    node.flags = bv.is_symbolic() ? NODE_SYMBOLIC : 0;
+    node.num_args = 1;
+    node.args[0] = to_node(bv);
+    node.args[1] = hi;
+    node.args[2] = lo;
+    return Expression::mk_symbolic(mk_node(node), node.width);
+}
+
+Expression ASTManager::mk_var_app(std::string name, unsigned int nBits) {
+    uint32_t name_id;
+    std::unordered_map<std::string, uint32_t>::iterator it = m_variable_ids.find(name);
+    if (it == m_variable_ids.end()) {
+        name_id = m_variable_names.size();
+        m_variable_names.push_back(name);
+        m_variable_ids[name] = name_id;
+    } else {
+        name_id = it->second;
+    }
+    ExpressionNode node;
+    memset(&node, 0, sizeof(node));
+    node.op = OP_VAR;
+    node.width = nBits;
+    node.flags = NODE_SYMBOLIC;
+    node.args[0] = name_id;
+    return Expression::mk_symbolic(mk_node(node), node.width);
+}
+
+void ASTManager::collect_variables(Expression expr, std::vector<bool> & visited, std::vector<uint32_t> & variables) {
+    if (!expr.is_symbolic()) {
+        return;
+    }
+    if (visited.size() < m_num_nodes) {
+        visited.resize(m_num_nodes, false);
+    }
+    std::vector<uint32_t> stack;
+    stack.push_back(expr.get_node());
+    while (!stack.empty()) {
+        uint32_t id = stack.back();
+        stack.pop_back();
+        if (visited[id]) {
+            continue;
+        }
+        visited[id] = true;
+        const ExpressionNode & node = get_node(id);
+        if (node.op == OP_VAR) {
+            variables.push_back(id);
+        }
+        for (unsigned int i = 0; i < node.num_args; ++i) {
+            // constant subterms cannot contain variables
+            if (get_node(node.args[i]).flags & NODE_SYMBOLIC) {
+                stack.push_back(node.args[i]);
+            }
+        }
+    }
+}
+
+bool ASTManager::depends_on_any(const std::vector<Expression> & exprs, const std::vector<uint32_t> & variables) {
+    if (variables.empty()) {
+        return false;
+    }
+    // a few terms out of a large table; don't pay for a visited flag per node
+    std::unordered_set<uint32_t> visited;
+    std::vector<uint32_t> stack;
+    for (std::vector<Expression>::const_iterator it = exprs.begin(); it != exprs.end(); ++it) {
+        if (it->is_symbolic()) {
+            stack.push_back(it->get_node());
+        }
+    }
+    while (!stack.empty()) {
+        uint32_t id = stack.back();
+        stack.pop_back();
+        if (!visited.insert(id).second) {
+            continue;
+        }
+        const ExpressionNode & node = get_node(id);
+        if (node.op == OP_VAR && std::binary_search(variables.begin(), variables.end(), id)) {
+            return true;
+        }
+        for (unsigned int i = 0; i < node.num_args; ++i) {
+            if (get_node(node.args[i]).flags & NODE_SYMBOLIC) {
+                stack.push_back(node.args[i]);
+            }
+        }
+    }
+    return false;
+}
+
+void ASTManager::get_relevant_assumptions(const PathCondition & path, const std::vector<Expression> & terms, std::vector<Expression> & relevant) {
+    // usually nothing in the terms is constrained, and the path need not be gathered
+    if (!depends_on_any(terms, path.get_variables())) {
+        return;
+    }
+    std::vector<Expression> assumptions;
+    assumptions.reserve(path.size());
+    path.collect(assumptions);
+    slice_path(assumptions, terms, relevant);
+}
@@ -0,0 +1,253 @@
+#include "ast_manager.h"
+#include "trace.h"
+
+/*
+ * Exhaustive feasibility checking for queries over a few narrow variables.
+ * Every node of the query is evaluated for a whole batch of candidate
+ * assignments at once, in lanes of a GCC vector type; the compiler maps
+ * the lane operations onto whatever SIMD instructions the target has.
+ */
+
+typedef uint64_t lanes __attribute__((vector_size(16)));
+static const unsigned int LANES = sizeof(lanes) / sizeof(uint64_t);
+// candidate assignments evaluated together
+static const unsigned int ENUM_BATCH = 256;
+
+static inline lanes splat(uint64_t x) {
+    lanes v = {};
+    for (unsigned int i = 0; i < LANES; ++i) {
+        v[i] = x;
+    }
+    return v;
+}
+
+static inline uint64_t width_mask(unsigned int width) {
+    return (width >= 64) ? ~(uint64_t)0 : (((uint64_t)1 << width) - 1);
+}
+
+ESolverStatus ASTManager::enumerate(const std::vector<uint32_t> & query, std::vector<uint64_t> & assignment) {
+    // nodes of the query in post-order, and the position of each in that order
+    std::vector<uint32_t> order;
+    std::unordered_map<uint32_t, uint32_t> position;
+    std::vector<uint32_t> variables;
+    unsigned int support_bits = 0;
+    std::vector<std::pair<uint32_t, bool> > stack;
+    for (size_t r = 0; r < query.size(); ++r) {
+        stack.push_back(std::make_pair(query[r], false));
+        while (!stack.empty()) {
+            uint32_t id = stack.back().first;
+            bool expanded = stack.back().second;
+            stack.pop_back();
+            if (position.count(id) != 0) {
+                continue;
+            }
+            const ExpressionNode & node = get_node(id);
+            if (node.op == OP_VAR || node.op == OP_BOOL_CONST || node.op == OP_BV_CONST || node.op == OP_INT_CONST
+                    || node.num_args == 0 || expanded) {
+                if (node.width > 64) {
+                    return UNKNOWN;
+                }
+                if (node.op == OP_VAR) {
+                    support_bits += node.width;
+                    if (support_bits > ENUM_MAX_BITS) {
+                        return UNKNOWN;
+                    }
+                    variables.push_back(id);
+                }
+                position[id] = order.size();
+                order.push_back(id);
+                if (order.size() > ENUM_MAX_NODES) {
+                    return UNKNOWN;
+                }
+            } else {
+                stack.push_back(std::make_pair(id, true));
+                for (unsigned int i = 0; i < node.num_args; ++i) {
+                    stack.push_back(std::make_pair(node.args[i], false));
+                }
+            }
+        }
+    }
+
+    // candidate k gives each variable the bits of k starting at its offset
+    std::unordered_map<uint32_t, unsigned int> offsets;
+    unsigned int offset = 0;
+    for (size_t j = 0; j < variables.size(); ++j) {
+        offsets[variables[j]] = offset;
+        offset += get_node(variables[j]).width;
+    }
+    uint64_t num_candidates = (uint64_t)1 << support_bits;
+    uint64_t batch = (num_candidates < ENUM_BATCH) ? num_candidates : ENUM_BATCH;
+    size_t vectors = (batch + LANES - 1) / LANES;
+    lanes iota;
+    for (unsigned int i = 0; i < LANES; ++i) {
+        iota[i] = i;
+    }
+    const lanes one = splat(1);
+    const lanes zero = splat(0);
+
+    // where each node finds its operands, and where the assertions are
+    std::vector<size_t> operand0(order.size(), 0);
+    std::vector<size_t> operand1(order.size(), 0);
+    std::vector<size_t> operand2(order.size(), 0);
+    for (size_t p = 0; p < order.size(); ++p) {
+        const ExpressionNode & node = get_node(order[p]);
+        if (node.op == OP_VAR || node.op == OP_BOOL_CONST || node.op == OP_BV_CONST || node.op == OP_INT_CONST) {
+            continue;
+        }
+        if (node.num_args > 0) {
+            operand0[p] = position[node.args[0]] * vectors;
+        }
+        if (node.num_args > 1) {
+            operand1[p] = position[node.args[1]] * vectors;
+        }
+        if (node.num_args > 2) {
+            operand2[p] = position[node.args[2]] * vectors;
+        }
+    }
+    std::vector<size_t> roots;
+    for (size_t r = 0; r < query.size(); ++r) {
+        roots.push_back(position[query[r]] * vectors);
+    }
+
+    std::vector<lanes> values(order.size() * vectors);
+    for (uint64_t base = 0; base < num_candidates; base += batch) {
+        for (size_t p = 0; p < order.size(); ++p) {
+            const ExpressionNode & node = get_node(order[p]);
+            lanes * out = &values[p * vectors];
+            const lanes * a = &values[operand0[p]];
+            const lanes * b = &values[operand1[p]];
+            const lanes * c = &values[operand2[p]];
+            const lanes mask = splat(width_mask(node.width));
+            switch (node.op) {
+            case OP_BOOL_CONST:
+            case OP_BV_CONST:
+            case OP_INT_CONST: {
+                lanes c = splat(((uint64_t)node.args[1] << 32) | node.args[0]);
+                for (size_t v = 0; v < vectors; ++v) out[v] = c;
+                break;
+            }
+            case OP_VAR: {
+                unsigned int shift = offsets[order[p]];
+                for (size_t v = 0; v < vectors; ++v) out[v] = ((splat(base + v * LANES) + iota) >> shift) & mask;
+                break;
+            }
+            case OP_ASSERT:
+                for (size_t v = 0; v < vectors; ++v) out[v] = a[v];
+                break;
+            case OP_AND:
+            case OP_BV_AND:
+                for (size_t v = 0; v < vectors; ++v) out[v] = a[v] & b[v];
+                break;
+            case OP_OR:
+            case OP_BV_OR:
+                for (size_t v = 0; v < vectors; ++v) out[v] = a[v] | b[v];
+                break;
+            case OP_BV_XOR:
+                for (size_t v = 0; v < vectors; ++v) out[v] = a[v] ^ b[v];
+                break;
+            case OP_NOT:
+                for (size_t v = 0; v < vectors; ++v) out[v] = a[v] ^ one;
+                break;
+            case OP_BV_NOT:
+                for (size_t v = 0; v < vectors; ++v) out[v] = ~a[v] & mask;
+                break;
+            case OP_BV_NEG:
+                for (size_t v = 0; v < vectors; ++v) out[v] = (zero - a[v]) & mask;
+                break;
+            case OP_BV_ADD:
+                for (size_t v = 0; v < vectors; ++v) out[v] = (a[v] + b[v]) & mask;
+                break;
+            case OP_BV_SUB:
+                for (size_t v = 0; v < vectors; ++v) out[v] = (a[v] - b[v]) & mask;
+                break;
+            case OP_BV_MUL:
+                for (size_t v = 0; v < vectors; ++v) out[v] = (a[v] * b[v]) & mask;
+                break;
+            case OP_BV_CONCAT: {
+                unsigned int low_width = get_node(node.args[1]).width;
+                for (size_t v = 0; v < vectors; ++v) out[v] = (a[v] << low_width) | b[v];
+                break;
+            }
+            case OP_BV_EXTRACT: {
+                unsigned int lo = node.args[2];
+                for (size_t v = 0; v < vectors; ++v) out[v] = (a[v] >> lo) & mask;
+                break;
+            }
+            case OP_BV_SHL:
+            case OP_BV_LSHR: {
+                // shifting by the width or more gives 0
+                const lanes width = splat(node.width);
+                const lanes amount_mask = splat(63);
+                for (size_t v = 0; v < vectors; ++v) {
+                    lanes in_range = (lanes)(b[v] < width);
+                    lanes shifted = (node.op == OP_BV_SHL) ? (a[v] << (b[v] & amount_mask)) : (a[v] >> (b[v] & amount_mask));
+                    out[v] = shifted & in_range & mask;
+                }
+                break;
+            }
+            case OP_EQ:
+                for (size_t v = 0; v < vectors; ++v) out[v] = (lanes)(a[v] == b[v]) & one;
+                break;
+            case OP_BV_ULT:
+                for (size_t v = 0; v < vectors; ++v) out[v] = (lanes)(a[v] < b[v]) & one;
+                break;
+            case OP_BV_ULE:
+                for (size_t v = 0; v < vectors; ++v) out[v] = (lanes)(a[v] <= b[v]) & one;
+                break;
+            case OP_BV_UGT:
+                for (size_t v = 0; v < vectors; ++v) out[v] = (lanes)(a[v] > b[v]) & one;
+                break;
+            case OP_BV_UGE:
+                for (size_t v = 0; v < vectors; ++v) out[v] = (lanes)(a[v] >= b[v]) & one;
+                break;
+            case OP_BV_SLT:
+            case OP_BV_SLE:
+            case OP_BV_SGT:
+            case OP_BV_SGE: {
+                // flipping the sign bit maps signed order onto unsigned order
+                const lanes sign = splat((uint64_t)1 << (get_node(node.args[0]).width - 1));
+                for (size_t v = 0; v < vectors; ++v) {
+                    lanes x = a[v] ^ sign;
+                    lanes y = b[v] ^ sign;
+                    switch (node.op) {
+                    case OP_BV_SLT: out[v] = (lanes)(x < y) & one; break;
+                    case OP_BV_SLE: out[v] = (lanes)(x <= y) & one; break;
+                    case OP_BV_SGT: out[v] = (lanes)(x > y) & one; break;
+                    default: out[v] = (lanes)(x >= y) & one; break;
+                    }
+                }
+                break;
+            }
+            case OP_ITE:
+                // the condition is 0 or 1; 0 - 1 selects every bit of the first branch
+                for (size_t v = 0; v < vectors; ++v) {
+                    lanes select = zero - a[v];
+                    out[v] = (b[v] & select) | (c[v] & ~select);
+                }
+                break;
+            default:
+                TRACE("solver", tout << "cannot enumerate operator " << (unsigned int)node.op << std::endl;);
+                return UNKNOWN;
+            }
+        }
+        // look for a candidate that satisfies every assertion
+        for (size_t v = 0; v < vectors; ++v) {
+            lanes satisfied = one;
+            for (size_t r = 0; r < roots.size(); ++r) {
+                satisfied &= values[roots[r] + v];
+            }
+            for (unsigned int i = 0; i < LANES; ++i) {
+                if (satisfied[i] != 0) {
+                    uint64_t k = base + v * LANES + i;
+                    assignment.assign(m_variable_names.size(), 0);
+                    for (size_t j = 0; j < variables.size(); ++j) {
+                        const ExpressionNode & var = get_node(variables[j]);
+                        assignment[var.args[0]] = (k >> offsets[variables[j]]) & width_mask(var.width);
+                    }
+                    return SAT;
+                }
+            }
+        }
+    }
+    return UNSAT;
+}
@@ -0,0 +1,152 @@
+#include "ast_manager.h"
+#include "trace.h"
+
+/*
+ * Concrete evaluation of expression DAGs under a variable assignment,
+ * and the store of recent satisfying assignments that check_assuming()
+ * tries before asking the solver.
+ */
+
+bool ASTManager::evaluate(uint32_t root, const std::vector<uint64_t> & assignment, uint64_t & value) {
+    if (m_eval_epoch.size() < m_num_nodes) {
+        m_eval_epoch.resize(m_num_nodes, 0);
+        m_eval_values.resize(m_num_nodes, 0);
+    }
+    std::vector<uint32_t> & stack = m_eval_stack;
+    stack.clear();
+    stack.push_back(root);
+    while (!stack.empty()) {
+        uint32_t id = stack.back();
+        if (m_eval_epoch[id] == m_eval_current_epoch) {
+            stack.pop_back();
+            continue;
+        }
+        const ExpressionNode & node = get_node(id);
+        if (node.width > 64) {
+            // too wide to evaluate with machine arithmetic
+            return false;
+        }
+        // evaluate the children first
+        bool ready = true;
+        if (node.op != OP_VAR && node.op != OP_BOOL_CONST && node.op != OP_BV_CONST && node.op != OP_INT_CONST) {
+            for (unsigned int i = 0; i < node.num_args; ++i) {
+                if (m_eval_epoch[node.args[i]] != m_eval_current_epoch) {
+                    stack.push_back(node.args[i]);
+                    ready = false;
+                }
+            }
+        }
+        if (!ready) {
+            continue;
+        }
+        stack.pop_back();
+        uint64_t result;
+        switch (node.op) {
+        case OP_BOOL_CONST:
+        case OP_BV_CONST:
+        case OP_INT_CONST:
+            result = ((uint64_t)node.args[1] << 32) | node.args[0];
+            break;
+        case OP_VAR:
+            // variables the assignment does not mention are taken to be 0
+            result = (node.args[0] < assignment.size()) ? assignment[node.args[0]] : 0;
+            result = Expression::mk_bv(result, node.width).get_value();
+            break;
+        case OP_ASSERT:
+            result = m_eval_values[node.args[0]];
+            break;
+        case OP_BV_EXTRACT:
+            result = Expression::mk_bv(m_eval_values[node.args[0]] >> node.args[2], node.width).get_value();
+            break;
+        case OP_ITE:
+            result = m_eval_values[node.args[0]] ? m_eval_values[node.args[1]] : m_eval_values[node.args[2]];
+            break;
+        default: {
+            const ExpressionNode & child0 = get_node(node.args[0]);
+            Expression arg0 = Expression::mk_bv(m_eval_values[node.args[0]], child0.width);
+            Expression arg1;
+            if (node.num_args > 1) {
+                arg1 = Expression::mk_bv(m_eval_values[node.args[1]], get_node(node.args[1]).width);
+            }
+            Expression folded = fold((EOpcode)node.op, arg0, arg1);
+            if (!folded.is_concrete()) {
+                return false;
+            }
+            result = folded.get_value();
+            break;
+        }
+        }
+        m_eval_values[id] = result;
+        m_eval_epoch[id] = m_eval_current_epoch;
+    }
+    value = m_eval_values[root];
+    return true;
+}
+
+void ASTManager::next_eval_epoch() {
+    m_eval_current_epoch += 1;
+    if (m_eval_current_epoch == 0) {
+        // wrapped around; forget every stamp
+        m_eval_epoch.assign(m_eval_epoch.size(), 0);
+        m_eval_current_epoch = 1;
+    }
+}
+
+bool ASTManager::find_model(const std::vector<uint32_t> & query, Model ** model) {
+    for (size_t i = 0; i < m_recent_models.size(); ++i) {
+        const std::vector<uint64_t> & assignment = m_recent_models[i];
+        next_eval_epoch();
+        bool satisfied = true;
+        // the newest constraints are the most likely to fail, and they have the largest indices
+        for (size_t j = query.size(); j > 0 && satisfied; --j) {
+            uint64_t value;
+            satisfied = evaluate(query[j - 1], assignment, value) && value != 0;
+        }
+        if (!satisfied) {
+            continue;
+        }
+        TRACE("solver", tout << "query satisfied by recent model #" << i << std::endl;);
+        if (model != NULL) {
+            assignment_to_model(query, assignment, **model);
+        }
+        // keep the most useful models at the front
+        if (i > 0) {
+            std::swap(m_recent_models[i], m_recent_models[i - 1]);
+        }
+        return true;
+    }
+    return false;
+}
+
+void ASTManager::remember_model(const std::vector<uint32_t> & query, Model & model) {
+    std::vector<uint64_t> assignment(m_variable_names.size(), 0);
+    std::vector<bool> visited;
+    std::vector<uint32_t> variables;
+    for (size_t j = 0; j < query.size(); ++j) {
+        collect_variables(get_expression(query[j]), visited, variables);
+    }
+    for (size_t j = 0; j < variables.size(); ++j) {
+        assignment[get_node(variables[j]).args[0]] = model.get_variable_value(get_variable_name(variables[j]));
+    }
+    remember_model(assignment);
+}
+
+void ASTManager::remember_model(const std::vector<uint64_t> & assignment) {
+    if (m_recent_models.size() >= MAX_RECENT_MODELS) {
+        m_recent_models.pop_back();
+    }
+    m_recent_models.insert(m_recent_models.begin(), assignment);
+}
+
+void ASTManager::assignment_to_model(const std::vector<uint32_t> & query, const std::vector<uint64_t> & assignment, Model & model) {
+    std::vector<bool> visited;
+    std::vector<uint32_t> variables;
+    for (size_t j = 0; j < query.size(); ++j) {
+        collect_variables(get_expression(query[j]), visited, variables);
+    }
+    for (size_t j = 0; j < variables.size(); ++j) {
+        const ExpressionNode & var = get_node(variables[j]);
+        uint64_t value = (var.args[0] < assignment.size()) ? assignment[var.args[0]] : 0;
+        model.add_variable(get_variable_name(variables[j]), value, var.width);
+    }
+}
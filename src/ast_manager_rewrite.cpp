@@ -0,0 +1,469 @@
+#include "ast_manager.h"
+
+/*
+ * Local rewrite rules applied when a term is constructed.
+ * Every rule either shrinks the term or moves it towards a canonical form:
+ *   - operands of commutative operators are ordered with constants last
+ *     and otherwise by ascending node index;
+ *   - shifts by a constant become concat/extract, and masks with a contiguous
+ *     run of ones become concat/extract, so bit-level structure stays visible;
+ *   - extract is pushed through concat, extract and bitwise operators;
+ *   - greater-than comparisons are turned around into less-than comparisons;
+ *   - identities and absorbing elements (x+0, x&0, x|~0, not(not x), ...) are removed;
+ *   - ite with a constant condition or equal branches is removed, and boolean ite
+ *     with a constant branch becomes and/or.
+ */
+
+static inline uint64_t get_bitmask(uint32_t nBits) {
+    if (nBits >= 64) {
+        return ~(uint64_t)0;
+    } else {
+        return ((uint64_t)1 << nBits) - 1;
+    }
+}
+
+// sign-extend a 'width'-bit value
+static inline int64_t to_signed(uint64_t val, uint8_t width) {
+    if (width >= 64) {
+        return (int64_t)val;
+    }
+    uint32_t shift = 64 - width;
+    return ((int64_t)(val << shift)) >> shift;
+}
+
+static inline bool is_value(Expression e, uint64_t val) {
+    return e.is_concrete() && e.get_value() == val;
+}
+
+static inline bool is_ones(Expression e) {
+    return e.is_concrete() && e.get_value() == get_bitmask(e.get_width());
+}
+
+static inline bool is_op(const ASTManager & m, Expression e, EOpcode op) {
+    return e.is_symbolic() && m.get_node(e.get_node()).op == op;
+}
+
+static inline Expression get_arg(const ASTManager & m, Expression e, unsigned int i) {
+    return m.get_expression(m.get_node(e.get_node()).args[i]);
+}
+
+static bool is_commutative(EOpcode op) {
+    switch (op) {
+    case OP_AND: case OP_OR: case OP_EQ:
+    case OP_BV_AND: case OP_BV_OR: case OP_BV_XOR:
+    case OP_BV_ADD: case OP_BV_MUL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// true iff one argument is the (boolean or bitwise) negation of the other
+static bool is_complement(const ASTManager & m, EOpcode neg, Expression arg0, Expression arg1) {
+    return (is_op(m, arg0, neg) && get_arg(m, arg0, 0) == arg1)
+        || (is_op(m, arg1, neg) && get_arg(m, arg1, 0) == arg0);
+}
+
+// if 'val' is a single contiguous run of ones, return its bounds
+static bool get_mask_range(uint64_t val, uint32_t & hi, uint32_t & lo) {
+    if (val == 0) {
+        return false;
+    }
+    lo = 0;
+    while (!(val & ((uint64_t)1 << lo))) {
+        ++lo;
+    }
+    hi = lo;
+    while (hi < 63 && (val & ((uint64_t)1 << (hi + 1)))) {
+        ++hi;
+    }
+    return (val >> lo) == get_bitmask(hi - lo + 1);
+}
+
+Expression ASTManager::fold(EOpcode op, Expression arg0, Expression arg1) {
+    uint64_t val0 = arg0.get_value();
+    uint64_t val1 = arg1.is_null() ? 0 : arg1.get_value();
+    uint8_t width = arg0.get_width();
+    switch (op) {
+    case OP_AND: return mk_bool(val0 && val1);
+    case OP_OR: return mk_bool(val0 || val1);
+    case OP_NOT: return mk_bool(val0 == 0);
+    case OP_EQ: return mk_bool(val0 == val1);
+    case OP_BV_AND: return Expression::mk_bv(val0 & val1, width);
+    case OP_BV_OR: return Expression::mk_bv(val0 | val1, width);
+    case OP_BV_XOR: return Expression::mk_bv(val0 ^ val1, width);
+    case OP_BV_NOT: return Expression::mk_bv(~val0, width);
+    case OP_BV_NEG: return Expression::mk_bv(-val0, width);
+    case OP_BV_ADD: return Expression::mk_bv(val0 + val1, width);
+    case OP_BV_SUB: return Expression::mk_bv(val0 - val1, width);
+    case OP_BV_MUL: return Expression::mk_bv(val0 * val1, width);
+    case OP_BV_CONCAT:
+        if (width + arg1.get_width() > 64) {
+            // too wide for a constant
+            break;
+        }
+        return Expression::mk_bv((val0 << arg1.get_width()) | val1, width + arg1.get_width());
+    case OP_BV_SHL: return Expression::mk_bv(val1 >= width ? 0 : (val0 << val1), width);
+    case OP_BV_LSHR: return Expression::mk_bv(val1 >= width ? 0 : (val0 >> val1), width);
+    case OP_BV_ULT: return mk_bool(val0 < val1);
+    case OP_BV_ULE: return mk_bool(val0 <= val1);
+    case OP_BV_UGT: return mk_bool(val0 > val1);
+    case OP_BV_UGE: return mk_bool(val0 >= val1);
+    case OP_BV_SLT: return mk_bool(to_signed(val0, width) < to_signed(val1, width));
+    case OP_BV_SLE: return mk_bool(to_signed(val0, width) <= to_signed(val1, width));
+    case OP_BV_SGT: return mk_bool(to_signed(val0, width) > to_signed(val1, width));
+    case OP_BV_SGE: return mk_bool(to_signed(val0, width) >= to_signed(val1, width));
+    default:
+        break;
+    }
+    return arg1.is_null() ? mk_app(op, arg0) : mk_app(op, arg0, arg1);
+}
+
+Expression ASTManager::mk_binary(EOpcode op, Expression arg0, Expression arg1) {
+    switch (op) {
+    case OP_AND: return mk_and(arg0, arg1);
+    case OP_OR: return mk_or(arg0, arg1);
+    case OP_EQ: return mk_eq(arg0, arg1);
+    case OP_BV_AND: return mk_bv_and(arg0, arg1);
+    case OP_BV_OR: return mk_bv_or(arg0, arg1);
+    case OP_BV_XOR: return mk_bv_xor(arg0, arg1);
+    case OP_BV_ADD: return mk_bv_add(arg0, arg1);
+    case OP_BV_SUB: return mk_bv_sub(arg0, arg1);
+    case OP_BV_MUL: return mk_bv_mul(arg0, arg1);
+    case OP_BV_CONCAT: return mk_bv_concat(arg0, arg1);
+    case OP_BV_SHL: return mk_bv_left_shift(arg0, arg1);
+    case OP_BV_LSHR: return mk_bv_logical_right_shift(arg0, arg1);
+    case OP_BV_ULT: return mk_bv_unsigned_less_than(arg0, arg1);
+    case OP_BV_ULE: return mk_bv_unsigned_less_than_or_equal(arg0, arg1);
+    case OP_BV_UGT: return mk_bv_unsigned_greater_than(arg0, arg1);
+    case OP_BV_UGE: return mk_bv_unsigned_greater_than_or_equal(arg0, arg1);
+    case OP_BV_SLT: return mk_bv_signed_less_than(arg0, arg1);
+    case OP_BV_SLE: return mk_bv_signed_less_than_or_equal(arg0, arg1);
+    case OP_BV_SGT: return mk_bv_signed_greater_than(arg0, arg1);
+    case OP_BV_SGE: return mk_bv_signed_greater_than_or_equal(arg0, arg1);
+    default:
+        throw "not a binary operator";
+    }
+}
+
+Expression ASTManager::rewrite(EOpcode op, Expression arg) {
+    if (arg.is_concrete()) {
+        return fold(op, arg, Expression());
+    }
+    switch (op) {
+    case OP_NOT:
+    case OP_BV_NOT:
+    case OP_BV_NEG:
+        // all three are involutions
+        if (is_op(*this, arg, op)) {
+            return get_arg(*this, arg, 0);
+        }
+        break;
+    default:
+        break;
+    }
+    return mk_app(op, arg);
+}
+
+Expression ASTManager::rewrite(EOpcode op, Expression arg0, Expression arg1) {
+    if (arg0.is_concrete() && arg1.is_concrete()) {
+        return fold(op, arg0, arg1);
+    }
+    if (is_commutative(op)) {
+        if ((arg0.is_concrete() && !arg1.is_concrete())
+            || (arg0.is_symbolic() && arg1.is_symbolic() && arg0.get_node() > arg1.get_node())) {
+            Expression tmp = arg0;
+            arg0 = arg1;
+            arg1 = tmp;
+        }
+    }
+    // from here on, for commutative operators only arg1 can be concrete
+    uint8_t width = arg0.get_width();
+    uint64_t c = arg1.is_concrete() ? arg1.get_value() : 0;
+    Expression zero = Expression::mk_bv(0, width);
+
+    switch (op) {
+    case OP_AND:
+        if (arg1.is_concrete()) {
+            return c ? arg0 : mk_bool(false);
+        } else if (arg0 == arg1) {
+            return arg0;
+        } else if (is_complement(*this, OP_NOT, arg0, arg1)) {
+            return mk_bool(false);
+        }
+        break;
+    case OP_OR:
+        if (arg1.is_concrete()) {
+            return c ? mk_bool(true) : arg0;
+        } else if (arg0 == arg1) {
+            return arg0;
+        } else if (is_complement(*this, OP_NOT, arg0, arg1)) {
+            return mk_bool(true);
+        }
+        break;
+    case OP_EQ:
+        if (arg0 == arg1) {
+            return mk_bool(true);
+        }
+        if (arg1.get_kind() == EXPR_BOOL) {
+            return c ? arg0 : mk_not(arg0);
+        }
+        if (arg1.is_concrete()) {
+            if (is_op(*this, arg0, OP_BV_CONCAT)) {
+                // compare both halves separately
+                Expression hi = get_arg(*this, arg0, 0);
+                Expression lo = get_arg(*this, arg0, 1);
+                return mk_and(mk_eq(hi, Expression::mk_bv(c >> lo.get_width(), hi.get_width())),
+                              mk_eq(lo, Expression::mk_bv(c, lo.get_width())));
+            }
+            if (is_op(*this, arg0, OP_BV_NOT)) {
+                return mk_eq(get_arg(*this, arg0, 0), Expression::mk_bv(~c, width));
+            }
+            if (is_op(*this, arg0, OP_BV_NEG)) {
+                return mk_eq(get_arg(*this, arg0, 0), Expression::mk_bv(-c, width));
+            }
+            if (is_op(*this, arg0, OP_BV_ADD) && get_arg(*this, arg0, 1).is_concrete()) {
+                // x + c1 == c  <=>  x == c - c1
+                return mk_eq(get_arg(*this, arg0, 0), Expression::mk_bv(c - get_arg(*this, arg0, 1).get_value(), width));
+            }
+            if (is_op(*this, arg0, OP_BV_XOR) && get_arg(*this, arg0, 1).is_concrete()) {
+                return mk_eq(get_arg(*this, arg0, 0), Expression::mk_bv(c ^ get_arg(*this, arg0, 1).get_value(), width));
+            }
+        }
+        break;
+    case OP_BV_AND:
+        if (arg1.is_concrete()) {
+            uint32_t hi, lo;
+            if (c == 0) {
+                return arg1;
+            } else if (is_ones(arg1)) {
+                return arg0;
+            } else if (is_op(*this, arg0, OP_BV_AND) && get_arg(*this, arg0, 1).is_concrete()) {
+                return mk_bv_and(get_arg(*this, arg0, 0), Expression::mk_bv(c & get_arg(*this, arg0, 1).get_value(), width));
+            } else if (is_op(*this, arg0, OP_BV_CONCAT)) {
+                Expression a = get_arg(*this, arg0, 0);
+                Expression b = get_arg(*this, arg0, 1);
+                return mk_bv_concat(mk_bv_and(a, Expression::mk_bv(c >> b.get_width(), a.get_width())),
+                                    mk_bv_and(b, Expression::mk_bv(c, b.get_width())));
+            } else if (get_mask_range(c, hi, lo)) {
+                // the mask selects bits hi..lo; zero-extend them back to the original position
+                Expression result = mk_bv_extract(arg0, mk_int(hi), mk_int(lo));
+                if (lo > 0) {
+                    result = mk_bv_concat(result, Expression::mk_bv(0, lo));
+                }
+                if (hi < (uint32_t)width - 1) {
+                    result = mk_bv_concat(Expression::mk_bv(0, width - 1 - hi), result);
+                }
+                return result;
+            }
+        } else if (arg0 == arg1) {
+            return arg0;
+        } else if (is_complement(*this, OP_BV_NOT, arg0, arg1)) {
+            return zero;
+        }
+        break;
+    case OP_BV_OR:
+        if (arg1.is_concrete()) {
+            if (c == 0) {
+                return arg0;
+            } else if (is_ones(arg1)) {
+                return arg1;
+            } else if (is_op(*this, arg0, OP_BV_OR) && get_arg(*this, arg0, 1).is_concrete()) {
+                return mk_bv_or(get_arg(*this, arg0, 0), Expression::mk_bv(c | get_arg(*this, arg0, 1).get_value(), width));
+            } else if (is_op(*this, arg0, OP_BV_CONCAT)) {
+                Expression a = get_arg(*this, arg0, 0);
+                Expression b = get_arg(*this, arg0, 1);
+                return mk_bv_concat(mk_bv_or(a, Expression::mk_bv(c >> b.get_width(), a.get_width())),
+                                    mk_bv_or(b, Expression::mk_bv(c, b.get_width())));
+            }
+        } else if (arg0 == arg1) {
+            return arg0;
+        } else if (is_complement(*this, OP_BV_NOT, arg0, arg1)) {
+            return Expression::mk_bv(get_bitmask(width), width);
+        }
+        break;
+    case OP_BV_XOR:
+        if (arg1.is_concrete()) {
+            if (c == 0) {
+                return arg0;
+            } else if (is_ones(arg1)) {
+                return mk_bv_not(arg0);
+            } else if (is_op(*this, arg0, OP_BV_XOR) && get_arg(*this, arg0, 1).is_concrete()) {
+                return mk_bv_xor(get_arg(*this, arg0, 0), Expression::mk_bv(c ^ get_arg(*this, arg0, 1).get_value(), width));
+            } else if (is_op(*this, arg0, OP_BV_CONCAT)) {
+                Expression a = get_arg(*this, arg0, 0);
+                Expression b = get_arg(*this, arg0, 1);
+                return mk_bv_concat(mk_bv_xor(a, Expression::mk_bv(c >> b.get_width(), a.get_width())),
+                                    mk_bv_xor(b, Expression::mk_bv(c, b.get_width())));
+            }
+        } else if (arg0 == arg1) {
+            return zero;
+        }
+        break;
+    case OP_BV_ADD:
+        if (arg1.is_concrete()) {
+            if (c == 0) {
+                return arg0;
+            } else if (is_op(*this, arg0, OP_BV_ADD) && get_arg(*this, arg0, 1).is_concrete()) {
+                return mk_bv_add(get_arg(*this, arg0, 0), Expression::mk_bv(c + get_arg(*this, arg0, 1).get_value(), width));
+            }
+        }
+        break;
+    case OP_BV_SUB:
+        if (arg0 == arg1) {
+            return zero;
+        } else if (arg1.is_concrete()) {
+            // x - c  ==>  x + (-c), so that chains of constant offsets combine
+            return mk_bv_add(arg0, Expression::mk_bv(-c, width));
+        }
+        break;
+    case OP_BV_MUL:
+        if (is_value(arg1, 0)) {
+            return arg1;
+        } else if (is_value(arg1, 1)) {
+            return arg0;
+        }
+        break;
+    case OP_BV_CONCAT:
+        if (is_op(*this, arg0, OP_BV_EXTRACT) && is_op(*this, arg1, OP_BV_EXTRACT)) {
+            // concat(x[h:m+1], x[m:l]) ==> x[h:l]
+            const ExpressionNode & n0 = get_node(arg0.get_node());
+            const ExpressionNode & n1 = get_node(arg1.get_node());
+            if (n0.args[0] == n1.args[0] && n0.args[2] == n1.args[1] + 1) {
+                return mk_bv_extract(get_expression(n0.args[0]), mk_int(n0.args[1]), mk_int(n1.args[2]));
+            }
+        }
+        break;
+    case OP_BV_SHL:
+        if (arg1.is_concrete()) {
+            if (c == 0) {
+                return arg0;
+            } else if (c >= width) {
+                return zero;
+            }
+            return mk_bv_concat(mk_bv_extract(arg0, mk_int(width - 1 - c), mk_int(0)), Expression::mk_bv(0, c));
+        }
+        break;
+    case OP_BV_LSHR:
+        if (arg1.is_concrete()) {
+            if (c == 0) {
+                return arg0;
+            } else if (c >= width) {
+                return zero;
+            }
+            return mk_bv_concat(Expression::mk_bv(0, c), mk_bv_extract(arg0, mk_int(width - 1), mk_int(c)));
+        }
+        break;
+    case OP_BV_UGT: return mk_bv_unsigned_less_than(arg1, arg0);
+    case OP_BV_UGE: return mk_bv_unsigned_less_than_or_equal(arg1, arg0);
+    case OP_BV_SGT: return mk_bv_signed_less_than(arg1, arg0);
+    case OP_BV_SGE: return mk_bv_signed_less_than_or_equal(arg1, arg0);
+    case OP_BV_ULT:
+        if (arg0 == arg1 || is_value(arg1, 0) || is_ones(arg0)) {
+            return mk_bool(false);
+        }
+        break;
+    case OP_BV_ULE:
+        if (arg0 == arg1 || is_value(arg0, 0) || is_ones(arg1)) {
+            return mk_bool(true);
+        }
+        break;
+    case OP_BV_SLT:
+        if (arg0 == arg1) {
+            return mk_bool(false);
+        } else if (is_value(arg1, 0)) {
+            // x < 0 iff the sign bit is set
+            Expression sign = mk_bv_extract(arg0, mk_int(width - 1), mk_int(width - 1));
+            return mk_eq(sign, Expression::mk_bv(1, 1));
+        }
+        break;
+    case OP_BV_SLE:
+        if (arg0 == arg1) {
+            return mk_bool(true);
+        } else if (is_value(arg0, 0)) {
+            // 0 <= x iff the sign bit is clear
+            Expression sign = mk_bv_extract(arg1, mk_int(arg1.get_width() - 1), mk_int(arg1.get_width() - 1));
+            return mk_eq(sign, Expression::mk_bv(0, 1));
+        }
+        break;
+    default:
+        break;
+    }
+    return mk_app(op, arg0, arg1);
+}
+
+Expression ASTManager::rewrite_extract(Expression bv, uint32_t hi, uint32_t lo) {
+    uint32_t width = hi - lo + 1;
+    if (bv.is_concrete()) {
+        return Expression::mk_bv(bv.get_value() >> lo, width);
+    }
+    if (lo == 0 && hi == (uint32_t)bv.get_width() - 1) {
+        return bv;
+    }
+    if (bv.is_symbolic()) {
+        const ExpressionNode & node = get_node(bv.get_node());
+        switch (node.op) {
+        case OP_BV_EXTRACT:
+            return mk_bv_extract(get_expression(node.args[0]), mk_int(node.args[2] + hi), mk_int(node.args[2] + lo));
+        case OP_BV_CONCAT: {
+            Expression a = get_expression(node.args[0]);
+            Expression b = get_expression(node.args[1]);
+            uint32_t split = b.get_width();
+            if (hi < split) {
+                return mk_bv_extract(b, mk_int(hi), mk_int(lo));
+            } else if (lo >= split) {
+                return mk_bv_extract(a, mk_int(hi - split), mk_int(lo - split));
+            } else {
+                return mk_bv_concat(mk_bv_extract(a, mk_int(hi - split), mk_int(0)),
+                                    mk_bv_extract(b, mk_int(split - 1), mk_int(lo)));
+            }
+        }
+        case OP_BV_NOT:
+            return mk_bv_not(mk_bv_extract(get_expression(node.args[0]), mk_int(hi), mk_int(lo)));
+        case OP_BV_AND:
+        case OP_BV_OR:
+        case OP_BV_XOR: {
+            // only worthwhile when the constant operand can simplify the result
+            Expression mask = get_expression(node.args[1]);
+            if (mask.is_concrete()) {
+                return mk_binary((EOpcode)node.op,
+                                 mk_bv_extract(get_expression(node.args[0]), mk_int(hi), mk_int(lo)),
+                                 Expression::mk_bv(mask.get_value() >> lo, width));
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return mk_extract_app(bv, hi, lo);
+}
+
+Expression ASTManager::rewrite_ite(Expression cond, Expression then_expr, Expression else_expr) {
+    if (cond.is_concrete()) {
+        return cond.get_value() ? then_expr : else_expr;
+    }
+    if (then_expr == else_expr) {
+        return then_expr;
+    }
+    // a negated condition swaps the branches
+    if (is_op(*this, cond, OP_NOT)) {
+        return mk_ite(get_arg(*this, cond, 0), else_expr, then_expr);
+    }
+    // a branch that tests the same condition again only ever takes one side
+    if (is_op(*this, then_expr, OP_ITE) && get_arg(*this, then_expr, 0) == cond) {
+        return mk_ite(cond, get_arg(*this, then_expr, 1), else_expr);
+    }
+    if (is_op(*this, else_expr, OP_ITE) && get_arg(*this, else_expr, 0) == cond) {
+        return mk_ite(cond, then_expr, get_arg(*this, else_expr, 2));
+    }
+    if (is_boolean(then_expr)) {
+        if (then_expr.is_concrete()) {
+            return then_expr.get_value() ? mk_or(cond, else_expr) : mk_and(mk_not(cond), else_expr);
+        }
+        if (else_expr.is_concrete()) {
+            return else_expr.get_value() ? mk_or(mk_not(cond), then_expr) : mk_and(cond, then_expr);
+        }
+    }
+    return mk_app(OP_ITE, cond, then_expr, else_expr);
+}
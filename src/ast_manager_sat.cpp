@@ -0,0 +1,404 @@
+#include "ast_manager.h"
+#include "sat_solver.h"
+#include "trace.h"
+#include <vector>
+#include <unordered_map>
+
+ASTManager_SAT::ASTManager_SAT() : m_solver(NULL), m_true(0) {}
+
+ASTManager_SAT::~ASTManager_SAT() {
+    delete m_solver;
+}
+
+void ASTManager_SAT::reset_solver() {
+    delete m_solver;
+    m_solver = new SATSolver();
+    m_node_bits.clear();
+    m_and_gates.clear();
+    m_xor_gates.clear();
+    // variable 0 is constant true
+    m_true = mk_literal(m_solver->new_var(), false);
+    m_solver->add_clause(std::vector<Literal>(1, m_true));
+}
+
+void ASTManager_SAT::drop_node_references() {
+    // the bit-blasted nodes are about to disappear
+    delete m_solver;
+    m_solver = NULL;
+    m_node_bits.clear();
+    m_and_gates.clear();
+    m_xor_gates.clear();
+    ASTManager_SMT2::drop_node_references();
+}
+
+ESolverStatus ASTManager_SAT::call_solver(std::vector<Expression> & assertions, Model ** model) {
+    if (m_solver == NULL) {
+        reset_solver();
+    }
+    uint32_t num_vars = m_solver->get_num_vars();
+    uint64_t num_conflicts = m_solver->get_num_conflicts();
+
+    std::vector<Literal> assumptions;
+    for (std::vector<Expression>::iterator it = assertions.begin(); it != assertions.end(); ++it) {
+        Expression assertion = *it;
+        if (!assertion.is_concrete()) {
+            assumptions.push_back(blast(assertion.get_node())[0]);
+        } else if (assertion.get_value() == 0) {
+            TRACE("solver", tout << "unsat (constant false assertion)" << std::endl;);
+            return UNSAT;
+        }
+    }
+    m_solver->set_budget(m_active_limits.conflicts, m_active_limits.timeout_ms);
+    ESATResult result = m_solver->solve(assumptions);
+    TRACE("solver", tout << "bit-blasted " << assertions.size() << " assertions into "
+          << (m_solver->get_num_vars() - num_vars) << " new variables ("
+          << m_solver->get_num_vars() << " total); "
+          << (m_solver->get_num_conflicts() - num_conflicts) << " conflicts" << std::endl;);
+
+    switch (result) {
+    case SAT_RESULT_SAT:
+        TRACE("solver", tout << "sat" << std::endl;);
+        if (model != NULL) {
+            std::vector<bool> visited;
+            std::vector<uint32_t> variables;
+            for (std::vector<Expression>::iterator it = assertions.begin(); it != assertions.end(); ++it) {
+                collect_variables(*it, visited, variables);
+            }
+            for (std::vector<uint32_t>::iterator it = variables.begin(); it != variables.end(); ++it) {
+                const std::vector<Literal> & bits = m_node_bits[*it];
+                uint32_t val = 0;
+                for (size_t i = 0; i < bits.size() && i < 32; ++i) {
+                    if (m_solver->get_model_value(literal_var(bits[i]))) {
+                        val |= (1u << i);
+                    }
+                }
+                (*model)->add_variable(get_variable_name(*it), val, bits.size());
+            }
+        }
+        return SAT;
+    case SAT_RESULT_UNSAT:
+        TRACE("solver", tout << "unsat" << std::endl;);
+        return UNSAT;
+    default:
+        TRACE("solver", tout << "unknown (out of budget)" << std::endl;);
+        return UNKNOWN;
+    }
+}
+
+const std::vector<Literal> & ASTManager_SAT::blast(uint32_t root) {
+    // post-order traversal; terms can be far deeper than is safe to recurse on
+    std::vector<uint32_t> stack;
+    stack.push_back(root);
+    while (!stack.empty()) {
+        uint32_t id = stack.back();
+        if (m_node_bits.find(id) != m_node_bits.end()) {
+            stack.pop_back();
+            continue;
+        }
+        const ExpressionNode & node = get_node(id);
+        bool ready = true;
+        for (unsigned int i = 0; i < node.num_args; ++i) {
+            if (m_node_bits.find(node.args[i]) == m_node_bits.end()) {
+                stack.push_back(node.args[i]);
+                ready = false;
+            }
+        }
+        if (ready) {
+            stack.pop_back();
+            blast_node(id, node);
+        }
+    }
+    return m_node_bits[root];
+}
+
+void ASTManager_SAT::blast_node(uint32_t id, const ExpressionNode & node) {
+    // references into an unordered_map stay valid when other elements are inserted
+    const std::vector<Literal> & a = m_node_bits[node.num_args > 0 ? node.args[0] : 0];
+    const std::vector<Literal> & b = m_node_bits[node.num_args > 1 ? node.args[1] : 0];
+    std::vector<Literal> & r = m_node_bits[id];
+
+    switch (node.op) {
+    case OP_BOOL_CONST:
+        r.push_back(node.args[0] ? m_true : mk_false());
+        break;
+    case OP_BV_CONST: {
+        uint64_t val = ((uint64_t)node.args[1] << 32) | node.args[0];
+        for (unsigned int i = 0; i < node.width; ++i) {
+            r.push_back(((val >> i) & 1) ? m_true : mk_false());
+        }
+        break;
+    }
+    case OP_VAR:
+        for (unsigned int i = 0; i < node.width; ++i) {
+            r.push_back(mk_fresh());
+        }
+        break;
+    case OP_ASSERT:
+        r = a;
+        break;
+    case OP_AND:
+        r.push_back(mk_and_gate(a[0], b[0]));
+        break;
+    case OP_OR:
+        r.push_back(mk_or_gate(a[0], b[0]));
+        break;
+    case OP_NOT:
+        r.push_back(negate(a[0]));
+        break;
+    case OP_EQ: {
+        Literal eq = m_true;
+        for (size_t i = 0; i < a.size(); ++i) {
+            eq = mk_and_gate(eq, negate(mk_xor_gate(a[i], b[i])));
+        }
+        r.push_back(eq);
+        break;
+    }
+    case OP_BV_AND:
+        for (size_t i = 0; i < a.size(); ++i) {
+            r.push_back(mk_and_gate(a[i], b[i]));
+        }
+        break;
+    case OP_BV_OR:
+        for (size_t i = 0; i < a.size(); ++i) {
+            r.push_back(mk_or_gate(a[i], b[i]));
+        }
+        break;
+    case OP_BV_XOR:
+        for (size_t i = 0; i < a.size(); ++i) {
+            r.push_back(mk_xor_gate(a[i], b[i]));
+        }
+        break;
+    case OP_BV_NOT:
+        for (size_t i = 0; i < a.size(); ++i) {
+            r.push_back(negate(a[i]));
+        }
+        break;
+    case OP_BV_NEG: {
+        // -a = ~a + 1
+        std::vector<Literal> not_a, zero(a.size(), mk_false());
+        for (size_t i = 0; i < a.size(); ++i) {
+            not_a.push_back(negate(a[i]));
+        }
+        mk_adder(not_a, zero, m_true, r);
+        break;
+    }
+    case OP_BV_ADD:
+        mk_adder(a, b, mk_false(), r);
+        break;
+    case OP_BV_SUB: {
+        // a - b = a + ~b + 1
+        std::vector<Literal> not_b;
+        for (size_t i = 0; i < b.size(); ++i) {
+            not_b.push_back(negate(b[i]));
+        }
+        mk_adder(a, not_b, m_true, r);
+        break;
+    }
+    case OP_BV_MUL: {
+        // shift-and-add
+        r.assign(a.size(), mk_false());
+        for (size_t i = 0; i < b.size(); ++i) {
+            std::vector<Literal> partial(a.size(), mk_false());
+            for (size_t j = i; j < a.size(); ++j) {
+                partial[j] = mk_and_gate(a[j - i], b[i]);
+            }
+            std::vector<Literal> sum;
+            mk_adder(r, partial, mk_false(), sum);
+            r.swap(sum);
+        }
+        break;
+    }
+    case OP_BV_CONCAT:
+        // the second operand supplies the low-order bits
+        r = b;
+        r.insert(r.end(), a.begin(), a.end());
+        break;
+    case OP_BV_EXTRACT:
+        r.assign(a.begin() + node.args[2], a.begin() + node.args[1] + 1);
+        break;
+    case OP_BV_SHL:
+        mk_shift(a, b, true, r);
+        break;
+    case OP_BV_LSHR:
+        mk_shift(a, b, false, r);
+        break;
+    case OP_BV_ULT:
+        r.push_back(mk_unsigned_less_than(a, b));
+        break;
+    case OP_BV_ULE:
+        r.push_back(negate(mk_unsigned_less_than(b, a)));
+        break;
+    case OP_BV_UGT:
+        r.push_back(mk_unsigned_less_than(b, a));
+        break;
+    case OP_BV_UGE:
+        r.push_back(negate(mk_unsigned_less_than(a, b)));
+        break;
+    case OP_BV_SLT:
+        r.push_back(mk_signed_less_than(a, b));
+        break;
+    case OP_BV_SLE:
+        r.push_back(negate(mk_signed_less_than(b, a)));
+        break;
+    case OP_BV_SGT:
+        r.push_back(mk_signed_less_than(b, a));
+        break;
+    case OP_BV_SGE:
+        r.push_back(negate(mk_signed_less_than(a, b)));
+        break;
+    case OP_ITE: {
+        const std::vector<Literal> & c = m_node_bits[node.args[2]];
+        for (size_t i = 0; i < b.size(); ++i) {
+            r.push_back(mk_mux_gate(a[0], b[i], c[i]));
+        }
+        break;
+    }
+    default:
+        throw "cannot bit-blast expression";
+    }
+}
+
+Literal ASTManager_SAT::mk_fresh() {
+    return mk_literal(m_solver->new_var(), false);
+}
+
+Literal ASTManager_SAT::mk_and_gate(Literal a, Literal b) {
+    if (a == mk_false() || b == mk_false() || a == negate(b)) {
+        return mk_false();
+    } else if (a == m_true || a == b) {
+        return b;
+    } else if (b == m_true) {
+        return a;
+    }
+    if (a > b) {
+        std::swap(a, b);
+    }
+    uint64_t key = ((uint64_t)a << 32) | b;
+    std::unordered_map<uint64_t, Literal>::iterator it = m_and_gates.find(key);
+    if (it != m_and_gates.end()) {
+        return it->second;
+    }
+    Literal x = mk_fresh();
+    std::vector<Literal> clause(2);
+    clause[0] = negate(x); clause[1] = a;
+    m_solver->add_clause(clause);
+    clause[0] = negate(x); clause[1] = b;
+    m_solver->add_clause(clause);
+    clause[0] = x; clause[1] = negate(a);
+    clause.push_back(negate(b));
+    m_solver->add_clause(clause);
+    m_and_gates[key] = x;
+    return x;
+}
+
+Literal ASTManager_SAT::mk_xor_gate(Literal a, Literal b) {
+    // xor(~a, b) = ~xor(a, b), so only gates over positive literals are created
+    bool flip = literal_sign(a) != literal_sign(b);
+    a = mk_literal(literal_var(a), false);
+    b = mk_literal(literal_var(b), false);
+    Literal x;
+    if (a == b) {
+        x = mk_false();
+    } else if (a == m_true) {
+        x = negate(b);
+    } else if (b == m_true) {
+        x = negate(a);
+    } else {
+        if (a > b) {
+            std::swap(a, b);
+        }
+        uint64_t key = ((uint64_t)a << 32) | b;
+        std::unordered_map<uint64_t, Literal>::iterator it = m_xor_gates.find(key);
+        if (it != m_xor_gates.end()) {
+            x = it->second;
+        } else {
+            x = mk_fresh();
+            std::vector<Literal> clause(3);
+            clause[0] = negate(x); clause[1] = a; clause[2] = b;
+            m_solver->add_clause(clause);
+            clause[0] = negate(x); clause[1] = negate(a); clause[2] = negate(b);
+            m_solver->add_clause(clause);
+            clause[0] = x; clause[1] = negate(a); clause[2] = b;
+            m_solver->add_clause(clause);
+            clause[0] = x; clause[1] = a; clause[2] = negate(b);
+            m_solver->add_clause(clause);
+            m_xor_gates[key] = x;
+        }
+    }
+    return flip ? negate(x) : x;
+}
+
+Literal ASTManager_SAT::mk_mux_gate(Literal sel, Literal t, Literal e) {
+    if (sel == m_true || t == e) {
+        return t;
+    } else if (sel == mk_false()) {
+        return e;
+    }
+    Literal x = mk_fresh();
+    std::vector<Literal> clause(3);
+    clause[0] = negate(sel); clause[1] = negate(t); clause[2] = x;
+    m_solver->add_clause(clause);
+    clause[0] = negate(sel); clause[1] = t; clause[2] = negate(x);
+    m_solver->add_clause(clause);
+    clause[0] = sel; clause[1] = negate(e); clause[2] = x;
+    m_solver->add_clause(clause);
+    clause[0] = sel; clause[1] = e; clause[2] = negate(x);
+    m_solver->add_clause(clause);
+    return x;
+}
+
+// ripple-carry adder; the carry out of the top bit is discarded
+void ASTManager_SAT::mk_adder(const std::vector<Literal> & a, const std::vector<Literal> & b, Literal carry, std::vector<Literal> & sum) {
+    sum.clear();
+    for (size_t i = 0; i < a.size(); ++i) {
+        Literal half = mk_xor_gate(a[i], b[i]);
+        sum.push_back(mk_xor_gate(half, carry));
+        if (i + 1 < a.size()) {
+            carry = mk_or_gate(mk_and_gate(a[i], b[i]), mk_and_gate(carry, half));
+        }
+    }
+}
+
+Literal ASTManager_SAT::mk_unsigned_less_than(const std::vector<Literal> & a, const std::vector<Literal> & b) {
+    // scanning upwards, the highest differing bit decides
+    Literal lt = mk_false();
+    for (size_t i = 0; i < a.size(); ++i) {
+        lt = mk_mux_gate(mk_xor_gate(a[i], b[i]), b[i], lt);
+    }
+    return lt;
+}
+
+Literal ASTManager_SAT::mk_signed_less_than(const std::vector<Literal> & a, const std::vector<Literal> & b) {
+    // flipping the sign bits maps two's complement order onto unsigned order
+    std::vector<Literal> a_flipped(a), b_flipped(b);
+    a_flipped.back() = negate(a_flipped.back());
+    b_flipped.back() = negate(b_flipped.back());
+    return mk_unsigned_less_than(a_flipped, b_flipped);
+}
+
+// barrel shifter; shifting by the width or more yields zero
+void ASTManager_SAT::mk_shift(const std::vector<Literal> & a, const std::vector<Literal> & amount, bool left, std::vector<Literal> & result) {
+    size_t width = a.size();
+    result = a;
+    for (size_t stage = 0; stage < amount.size(); ++stage) {
+        Literal sel = amount[stage];
+        if (stage >= 63 || ((uint64_t)1 << stage) >= width) {
+            for (size_t i = 0; i < width; ++i) {
+                result[i] = mk_and_gate(result[i], negate(sel));
+            }
+            continue;
+        }
+        size_t shift = (size_t)1 << stage;
+        std::vector<Literal> shifted(width);
+        for (size_t i = 0; i < width; ++i) {
+            Literal src;
+            if (left) {
+                src = (i >= shift) ? result[i - shift] : mk_false();
+            } else {
+                src = (i + shift < width) ? result[i + shift] : mk_false();
+            }
+            shifted[i] = mk_mux_gate(sel, src, result[i]);
+        }
+        result.swap(shifted);
+    }
+}
@@ -2,749 +2,680 @@
 #include "expression.h"
 #include <cstdint>
 #include "trace.h"
+#include "smt2_writer.h"
+#include "solver_pool.h"
 #include <set>
 #include <map>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <poll.h>
 #include <cstdio>
 #include <cstring>
 #include <errno.h>
 #include <sstream>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <algorithm>
 
-static inline uint32_t get_bitmask(uint32_t nBits) {
-    if (nBits >= 32) {
-        return 0xFFFFFFFF;
-    } else {
-        return (1 << nBits) - 1;
+static const char * get_opcode_name(EOpcode op) {
+    switch (op) {
+    case OP_AND: return "and";
+    case OP_OR: return "or";
+    case OP_NOT: return "not";
+    case OP_EQ: return "=";
+    case OP_ASSERT: return "assert";
+    case OP_BV_AND: return "bvand";
+    case OP_BV_OR: return "bvor";
+    case OP_BV_XOR: return "bvxor";
+    case OP_BV_NOT: return "bvnot";
+    case OP_BV_NEG: return "bvneg";
+    case OP_BV_ADD: return "bvadd";
+    case OP_BV_SUB: return "bvsub";
+    case OP_BV_MUL: return "bvmul";
+    case OP_BV_CONCAT: return "concat";
+    case OP_BV_SHL: return "bvshl";
+    case OP_BV_LSHR: return "bvlshr";
+    case OP_BV_ULT: return "bvult";
+    case OP_BV_ULE: return "bvule";
+    case OP_BV_UGT: return "bvugt";
+    case OP_BV_UGE: return "bvuge";
+    case OP_BV_SLT: return "bvslt";
+    case OP_BV_SLE: return "bvsle";
+    case OP_BV_SGT: return "bvsgt";
+    case OP_BV_SGE: return "bvsge";
+    case OP_ITE: return "ite";
+    default:
+        throw "no SMT2 operator for opcode";
     }
 }
 
-class SMT2Expression : public Expression {
-public:
-    SMT2Expression() {}
-    virtual ~SMT2Expression() {}
-
-    virtual std::string to_string() const = 0;
-
-    virtual void collect_variables(std::map<std::string, SMT2Expression*> & variables) = 0;
-};
-
-class BitVectorVariable : public SMT2Expression {
-public:
-    BitVectorVariable(std::string name, uint8_t bits) : m_name(name), m_bits(bits) {
-    }
-    virtual ~BitVectorVariable() {}
-
-    std::string to_string() const {
-        return m_name;
-    }
-
-    bool is_concrete() { return false;}
-    uint32_t get_value() { return 0; }
-    uint8_t get_width() { return m_bits; }
-
-    void collect_variables(std::map<std::string, SMT2Expression*> & variables) {
-        variables[m_name] = this;
-    }
-protected:
-    std::string m_name;
-    uint8_t m_bits;
-};
-
-class BooleanConstant : public SMT2Expression {
-public:
-    BooleanConstant(bool val) : m_val(val) {
-    }
-    virtual ~BooleanConstant() {}
-
-    std::string to_string() const {
-        if (m_val) {
-            return "true";
-        } else {
-            return "false";
-        }
-    }
-
-    bool is_concrete() { return true; }
-    uint32_t get_value() { if (m_val) return 1 ; else return 0; }
-    uint8_t get_width() { return 1; }
-
-    void collect_variables(std::map<std::string, SMT2Expression*> & variables) {
-        // no-op
-    }
-protected:
-    bool m_val;
-};
-
-class ByteConstant : public SMT2Expression {
-public:
-    ByteConstant(uint8_t val) : m_val(val) {
-    }
-    virtual ~ByteConstant() {}
-
-    std::string to_string() const {
-        // we want to generate a constant of the form #bNNNNNNNN where each N is either 0 or 1
-        std::string val = "#b";
-        for(int i = 7; i >= 0; --i) {
-            if ((m_val & (1 << i)) != 0) {
-                val += "1";
-            } else {
-                val += "0";
-            }
-        }
-        return val;
-    }
-
-    bool is_concrete() { return true; }
-    uint32_t get_value() { return ((uint32_t)m_val) & 0x000000FF; }
-    uint8_t get_width() { return 8; }
-
-    void collect_variables(std::map<std::string, SMT2Expression*> & variables) {
-        // no-op
-    }
-protected:
-    uint8_t m_val;
-};
-
-class HalfwordConstant : public SMT2Expression {
-public:
-    HalfwordConstant(uint16_t val) : m_val(val) {
-    }
-    virtual ~HalfwordConstant() {}
-
-    std::string to_string() const {
-        // we want to generate a constant of the form #bNNNNNNNN where each N is either 0 or 1
-        std::string val = "#b";
-        for(int i = 15; i >= 0; --i) {
-            if ((m_val & (1 << i)) != 0) {
-                val += "1";
-            } else {
-                val += "0";
-            }
-        }
-        return val;
-    }
-
-    bool is_concrete() { return true; }
-    uint32_t get_value() { return ((uint32_t)m_val) & 0x0000FFFF; }
-    uint8_t get_width() { return 16; }
-
-    void collect_variables(std::map<std::string, SMT2Expression*> & variables) {
-        // no-op
-    }
-protected:
-    uint16_t m_val;
-};
-
-class IntegerConstant : public SMT2Expression {
-public:
-    IntegerConstant(int32_t val) : m_val(val) {
-    }
-    virtual ~IntegerConstant() {}
-
-    std::string to_string() const {
-        return std::to_string(m_val);
+// we want to generate a constant of the form #bNNNNNNNN where each N is either 0 or 1
+static void write_bv_constant(SMT2Writer & out, uint64_t val, uint8_t width) {
+    out.write("#b");
+    for (int i = width - 1; i >= 0; --i) {
+        out.write(((val & ((uint64_t)1 << i)) != 0) ? '1' : '0');
     }
+}
 
-    bool is_concrete() { return true; }
-    uint32_t get_value() { return m_val; }
-    uint8_t get_width() { return 32; }
+ASTManager_SMT2::ASTManager_SMT2() : m_solver_pool(NULL), m_session_pid(-1), m_session_input(-1), m_session_output(-1) {
+    SolverCommand stp;
+    SolverCommand::lookup("stp", stp);
+    m_solver_commands.push_back(stp);
+}
 
-    void collect_variables(std::map<std::string, SMT2Expression*> & variables) {
-        // no-op
-    }
-protected:
-    int32_t m_val;
-};
+ASTManager_SMT2::~ASTManager_SMT2() {
+    delete m_solver_pool;
+    stop_session();
+}
 
-class UnaryOp : public SMT2Expression {
-public:
-    UnaryOp(std::string oper, SMT2Expression * arg0) : m_op(oper), m_arg(arg0) {
+void ASTManager_SMT2::set_solver_threads(unsigned int num_threads) {
+    delete m_solver_pool;
+    m_solver_pool = NULL;
+    if (num_threads > 0) {
+        m_solver_pool = new SolverPool(num_threads);
     }
-    virtual ~UnaryOp() {}
+}
 
-    std::string to_string() const {
-        std::string str = "(";
-        str += m_op;
-        str += " ";
-        str += m_arg->to_string();
-        str += ")";
-        return str;
+void ASTManager_SMT2::set_solver_commands(const std::vector<SolverCommand> & commands) {
+    if (commands.empty()) {
+        throw "at least one solver is required";
     }
+    // the session may be running a solver that is no longer wanted
+    stop_session();
+    m_solver_commands = commands;
+}
 
-    bool is_concrete() { return false; }
-    uint32_t get_value() { return 0; }
-    uint8_t get_width() { return 0; }
-
-    void collect_variables(std::map<std::string, SMT2Expression*> & variables) {
-        m_arg->collect_variables( variables);
-    }
-protected:
-    std::string m_op;
-    SMT2Expression * m_arg;
-};
+void ASTManager_SMT2::drop_node_references() {
+    // names in the session refer to nodes that are about to disappear
+    stop_session();
+    ASTManager::drop_node_references();
+}
 
-class BinaryOp : public SMT2Expression {
-public:
-    BinaryOp(std::string oper, SMT2Expression * arg0, SMT2Expression * arg1) : m_op(oper), m_arg0(arg0), m_arg1(arg1) {
-    }
-    virtual ~BinaryOp() {}
+Expression ASTManager_SMT2::mk_var(std::string name, unsigned int nBits) {
+    return mk_var_app(name, nBits);
+}
 
-    std::string to_string() const {
-        std::string str = "(";
-        str += m_op;
-        str += " ";
-        str += m_arg0->to_string();
-        str += " ";
-        str += m_arg1->to_string();
-        str += ")";
-        return str;
-    }
+Expression ASTManager_SMT2::mk_and(Expression arg0, Expression arg1) {
+    return rewrite(OP_AND, arg0, arg1);
+}
 
-    bool is_concrete() { return false; }
-    uint32_t get_value() { return 0; }
-    uint8_t get_width() { return 0; }
+Expression ASTManager_SMT2::mk_or(Expression arg0, Expression arg1) {
+    return rewrite(OP_OR, arg0, arg1);
+}
 
-    void collect_variables(std::map<std::string, SMT2Expression*> & variables) {
-        m_arg0->collect_variables(variables);
-        m_arg1->collect_variables(variables);
-    }
-protected:
-    std::string m_op;
-    SMT2Expression * m_arg0;
-    SMT2Expression * m_arg1;
-};
+Expression ASTManager_SMT2::mk_not(Expression arg) {
+    return rewrite(OP_NOT, arg);
+}
 
-class ExtractOp : public SMT2Expression {
-public:
-    ExtractOp(SMT2Expression * bv, SMT2Expression * hi, SMT2Expression * lo) : m_bv(bv), m_hi(hi), m_lo(lo) {
-    }
-    virtual ~ExtractOp(){}
+Expression ASTManager_SMT2::mk_eq(Expression arg0, Expression arg1) {
+    // we assume that this is well-sorted
+    return rewrite(OP_EQ, arg0, arg1);
+}
 
-    std::string to_string() const {
-        std::string str = "((_ extract ";
-        str += m_hi->to_string();
-        str += " ";
-        str += m_lo->to_string();
-        str += ") ";
-        str += m_bv->to_string();
-        str += ")";
-        return str;
-    }
+Expression ASTManager_SMT2::mk_assert(Expression arg) {
+    return mk_app(OP_ASSERT, arg);
+}
 
-    bool is_concrete() { return false; }
-    uint32_t get_value() { return 0; }
-    uint8_t get_width() { return 0; }
+/*
+ * bitvector terms
+ * Terms whose operands are all concrete are folded by rewrite() at any width up to 64 bits.
+ */
 
-    void collect_variables(std::map<std::string, SMT2Expression*> & variables) {
-        m_bv->collect_variables(variables);
-        m_hi->collect_variables(variables);
-        m_lo->collect_variables(variables);
-    }
-protected:
-    SMT2Expression * m_bv;
-    SMT2Expression * m_hi;
-    SMT2Expression * m_lo;
-};
+Expression ASTManager_SMT2::mk_bv_and(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_AND, arg0, arg1);
+}
 
-Expression * ASTManager_SMT2::mk_byte(uint8_t val) {
-    return new ByteConstant(val);
+Expression ASTManager_SMT2::mk_bv_or(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_OR, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_halfword(uint16_t val) {
-    return new HalfwordConstant(val);
+Expression ASTManager_SMT2::mk_bv_xor(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_XOR, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_var(std::string name, unsigned int nBits) {
-    return new BitVectorVariable(name, nBits);
+Expression ASTManager_SMT2::mk_bv_not(Expression arg) {
+    return rewrite(OP_BV_NOT, arg);
 }
 
-Expression * ASTManager_SMT2::mk_int(int32_t val) {
-    return new IntegerConstant(val);
+Expression ASTManager_SMT2::mk_bv_neg(Expression arg) {
+    return rewrite(OP_BV_NEG, arg);
 }
 
-Expression * ASTManager_SMT2::mk_bool(bool val) {
-    return new BooleanConstant(val);
+Expression ASTManager_SMT2::mk_bv_add(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_ADD, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_and(Expression * arg0, Expression * arg1) {
-    // we assume that this is well-sorted
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value() & get_bitmask(arg0->get_width());
-        uint32_t val1 = arg1->get_value() & get_bitmask(arg1->get_width());
-        return new BooleanConstant(val0 && val1);
-    } else {
-        return new BinaryOp("and", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
-    }
+Expression ASTManager_SMT2::mk_bv_sub(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_SUB, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_or(Expression * arg0, Expression * arg1) {
-    // we assume that this is well-sorted
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value() & get_bitmask(arg0->get_width());
-        uint32_t val1 = arg1->get_value() & get_bitmask(arg1->get_width());
-        return new BooleanConstant(val0 || val1);
-    } else {
-        return new BinaryOp("=", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
-    }
+Expression ASTManager_SMT2::mk_bv_mul(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_MUL, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_not(Expression * arg) {
-    // we really, really assume that this is well-sorted
-    if (arg->is_concrete()) {
-        return new BooleanConstant(arg->get_value() == 0);
-    } else {
-        return new UnaryOp("not", (SMT2Expression*)arg);
-    }
+Expression ASTManager_SMT2::mk_bv_concat(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_CONCAT, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_eq(Expression * arg0, Expression * arg1) {
-    // we assume that this is well-sorted
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value() & get_bitmask(arg0->get_width());
-        uint32_t val1 = arg1->get_value() & get_bitmask(arg1->get_width());
-        return new BooleanConstant(val0 == val1);
-    } else {
-        return new BinaryOp("=", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+Expression ASTManager_SMT2::mk_bv_extract(Expression bv, Expression hi, Expression lo) {
+    if (!hi.is_concrete() || !lo.is_concrete()) {
+        throw "extract indices must be concrete";
     }
+    return rewrite_extract(bv, (uint32_t)hi.get_value(), (uint32_t)lo.get_value());
 }
 
-Expression * ASTManager_SMT2::mk_assert(Expression * arg) {
-    return new UnaryOp("assert", (SMT2Expression*)arg);
+Expression ASTManager_SMT2::mk_bv_left_shift(Expression bv, Expression shiftamt) {
+    return rewrite(OP_BV_SHL, bv, shiftamt);
 }
 
-// bitvector terms
-
-Expression * ASTManager_SMT2::mk_bv_and(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value();
-        uint32_t val1 = arg1->get_value();
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            return new ByteConstant( (uint8_t) ((val0 & val1) & get_bitmask(8)));
-        } else if (arg0->get_width() == 16 && arg1->get_width() == 16) {
-            return new HalfwordConstant( (uint16_t) ((val0 & val1) & get_bitmask(16)));
-        }
-    }
-    // fall through
-    return new BinaryOp("bvand", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+Expression ASTManager_SMT2::mk_bv_logical_right_shift(Expression bv, Expression shiftamt) {
+    return rewrite(OP_BV_LSHR, bv, shiftamt);
 }
 
-Expression * ASTManager_SMT2::mk_bv_or(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value();
-        uint32_t val1 = arg1->get_value();
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            return new ByteConstant( (uint8_t) ((val0 | val1) & get_bitmask(8)));
-        } else if (arg0->get_width() == 16 && arg1->get_width() == 16) {
-            return new HalfwordConstant( (uint16_t) ((val0 | val1) & get_bitmask(16)));
-        }
-    }
-    // fall through
-    return new BinaryOp("bvor", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+Expression ASTManager_SMT2::mk_bv_unsigned_less_than(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_ULT, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_bv_xor(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value();
-        uint32_t val1 = arg1->get_value();
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            return new ByteConstant( (uint8_t) ((val0 ^ val1) & get_bitmask(8)));
-        } else if (arg0->get_width() == 16 && arg1->get_width() == 16) {
-            return new HalfwordConstant( (uint16_t) ((val0 ^ val1) & get_bitmask(16)));
-        }
-    }
-    // fall through
-    return new BinaryOp("bvxor", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+Expression ASTManager_SMT2::mk_bv_unsigned_less_than_or_equal(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_ULE, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_bv_not(Expression * arg) {
-    if (arg->is_concrete()) {
-        uint32_t val = arg->get_value();
-        if (arg->get_width() == 8) {
-            return new ByteConstant((~val) & get_bitmask(8));
-        } else if (arg->get_width() == 16) {
-            return new HalfwordConstant((~val) & get_bitmask(16));
-        }
-    }
-    // fall through
-    return new UnaryOp("bvnot", (SMT2Expression*)arg);
+Expression ASTManager_SMT2::mk_bv_unsigned_greater_than(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_UGT, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_bv_neg(Expression * arg) {
-    if (arg->is_concrete()) {
-        uint32_t val = arg->get_value();
-        if (arg->get_width() == 8) {
-            return new ByteConstant((-val) & get_bitmask(8));
-        } else if (arg->get_width() == 16) {
-            return new HalfwordConstant((-val) & get_bitmask(16));
-        }
-    }
-    // fall through
-    return new UnaryOp("bvnot", (SMT2Expression*)arg);
+Expression ASTManager_SMT2::mk_bv_unsigned_greater_than_or_equal(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_UGE, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_bv_add(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value();
-        uint32_t val1 = arg1->get_value();
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            return new ByteConstant( (uint8_t) ((val0 + val1) & get_bitmask(8)));
-        } else if (arg0->get_width() == 16 && arg1->get_width() == 16) {
-            return new HalfwordConstant( (uint16_t) ((val0 + val1) & get_bitmask(16)));
-        }
-    }
-    // fall through
-    return new BinaryOp("bvadd", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+Expression ASTManager_SMT2::mk_bv_signed_less_than(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_SLT, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_bv_sub(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value();
-        uint32_t val1 = arg1->get_value();
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            return new ByteConstant( (uint8_t) ((val0 - val1) & get_bitmask(8)));
-        } else if (arg0->get_width() == 16 && arg1->get_width() == 16) {
-            return new HalfwordConstant( (uint16_t) ((val0 - val1) & get_bitmask(16)));
-        }
-    }
-    // fall through
-    return new BinaryOp("bvsub", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+Expression ASTManager_SMT2::mk_bv_signed_less_than_or_equal(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_SLE, arg0, arg1);
 }
 
-Expression * ASTManager_SMT2::mk_bv_mul(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value();
-        uint32_t val1 = arg1->get_value();
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            return new ByteConstant( (uint8_t) ((val0 * val1) & get_bitmask(8)));
-        } else if (arg0->get_width() == 16 && arg1->get_width() == 16) {
-            return new HalfwordConstant( (uint16_t) ((val0 * val1) & get_bitmask(16)));
-        }
-    }
-    // fall through
-    return new BinaryOp("bvmul", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+Expression ASTManager_SMT2::mk_bv_signed_greater_than(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_SGT, arg0, arg1);
 }
 
-// TODO potentially create a better constant type in order to perform concat and extract concretely too
+Expression ASTManager_SMT2::mk_bv_signed_greater_than_or_equal(Expression arg0, Expression arg1) {
+    return rewrite(OP_BV_SGE, arg0, arg1);
+}
 
-Expression * ASTManager_SMT2::mk_bv_concat(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value();
-        uint32_t val1 = arg1->get_value();
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            return new HalfwordConstant((val0 << 8 | val1) & get_bitmask(16));
-        }
+Expression ASTManager_SMT2::mk_ite(Expression cond, Expression then_expr, Expression else_expr) {
+    if (!is_boolean(cond)) {
+        throw "condition of ite must be boolean";
     }
-    return new BinaryOp("concat", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
-}
-
-Expression * ASTManager_SMT2::mk_bv_extract(Expression * bv, Expression * hi, Expression * lo) {
-    if (bv->is_concrete() && hi->is_concrete() && lo->is_concrete()) {
-        uint32_t bv_val = bv->get_value();
-        int32_t high_bit = (int32_t)hi->get_value();
-        int32_t low_bit = (int32_t)lo->get_value();
-        if (high_bit - low_bit + 1 == 8) {
-            // start by masking out everything above the highest bit
-            uint32_t mask = get_bitmask(high_bit + 1);
-            bv_val &= mask;
-            // then shift down to clear out everything below the lowest bit
-            bv_val >>= low_bit;
-            return new ByteConstant(bv_val);
-        }
+    if (then_expr.get_width() != else_expr.get_width() || is_boolean(then_expr) != is_boolean(else_expr)) {
+        throw "branches of ite have different sorts";
     }
-    return new ExtractOp((SMT2Expression*)bv, (SMT2Expression*)hi, (SMT2Expression*)lo);
+    return rewrite_ite(cond, then_expr, else_expr);
 }
 
-Expression * ASTManager_SMT2::mk_bv_left_shift(Expression * bv, Expression * shiftamt) {
-    if (bv->is_concrete() && shiftamt->is_concrete()) {
-        uint32_t bv_val = bv->get_value();
-        uint32_t shiftamt_val = shiftamt->get_value();
-        if (bv->get_width() == 8 && shiftamt->get_width() == 8) {
-            return new ByteConstant( (uint8_t) ((bv_val << shiftamt_val) & get_bitmask(8)));
-        } else if (bv->get_width() == 16 && shiftamt->get_width() == 16) {
-            return new HalfwordConstant( (uint16_t) ((bv_val << shiftamt_val) & get_bitmask(16)));
+/*
+ * Send 'instance' to every solver in 'commands' and return the first definitive answer,
+ * killing the solvers that are still working. If 'model' is not NULL, the winner's
+ * model is added to it. The race is abandoned as UNKNOWN once 'limits' allows no more
+ * time; solvers that run out of memory are killed and also count as UNKNOWN.
+ * Only uses its arguments, so it may run on any thread.
+ */
+static ESolverStatus race_solvers(const std::vector<SolverCommand> & commands, const std::string & instance,
+        const SolverLimits & limits, Model * model) {
+    bool want_model = (model != NULL);
+    // a solver process taking part in the race
+    struct Racer {
+        const SolverCommand * command;
+        pid_t pid;
+        int output; // -1 once the solver has finished
+        std::string response;
+    };
+    std::vector<Racer> racers;
+    for (std::vector<SolverCommand>::const_iterator it = commands.begin(); it != commands.end(); ++it) {
+        Racer racer;
+        int input;
+        racer.command = &*it;
+        racer.pid = it->spawn(want_model, limits.memory_bytes, input, racer.output);
+        if (racer.pid == -1) {
+            continue;
+        }
+        try {
+            SMT2Writer out(input);
+            out.write(it->get_prologue(want_model));
+            out.write(instance);
+            out.write(it->get_epilogue(want_model));
+            out.flush();
+        } catch (const char * msg) {
+            // the solver has probably died already; its (empty) response says so
+            TRACE("solver", tout << "error: could not send instance to " << it->name << ": " << msg << std::endl;);
+        }
+        // send EOF
+        close(input);
+        racers.push_back(racer);
+    }
+    if (racers.empty()) {
+        TRACE("solver", tout << "error: could not start any solver" << std::endl;);
+        return ESolverStatus::ERROR;
+    }
+
+    // wait for the first definitive answer
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+        + std::chrono::milliseconds(limits.timeout_ms);
+    ESolverStatus result = ESolverStatus::ERROR;
+    size_t running = racers.size();
+    int winner = -1;
+    std::vector<struct pollfd> fds;
+    std::vector<size_t> fd_racers;
+    while (running > 0 && winner == -1) {
+        fds.clear();
+        fd_racers.clear();
+        for (size_t i = 0; i < racers.size(); ++i) {
+            if (racers[i].output != -1) {
+                struct pollfd fd;
+                fd.fd = racers[i].output;
+                fd.events = POLLIN;
+                fd.revents = 0;
+                fds.push_back(fd);
+                fd_racers.push_back(i);
+            }
+        }
+        int timeout = -1;
+        if (limits.timeout_ms != 0) {
+            std::chrono::steady_clock::duration remaining = deadline - std::chrono::steady_clock::now();
+            timeout = std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count());
+        }
+        int ready = poll(&fds[0], fds.size(), timeout);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            TRACE("solver", tout << "error: could not wait for solvers: " << std::strerror(errno) << std::endl;);
+            break;
+        } else if (ready == 0) {
+            TRACE("solver", tout << "solvers timed out after " << limits.timeout_ms << " ms" << std::endl;);
+            result = ESolverStatus::UNKNOWN;
+            break;
+        }
+        for (size_t f = 0; f < fds.size() && winner == -1; ++f) {
+            if (fds[f].revents == 0) {
+                continue;
+            }
+            Racer & racer = racers[fd_racers[f]];
+            char out_buf[2048];
+            ssize_t bytes_read = read(racer.output, out_buf, sizeof(out_buf));
+            if (bytes_read > 0) {
+                racer.response.append(out_buf, bytes_read);
+                continue;
+            } else if (bytes_read == -1 && errno == EINTR) {
+                continue;
+            }
+            // this solver is done
+            if (bytes_read == -1) {
+                TRACE("solver", tout << "could not read response of " << racer.command->name << ": " << std::strerror(errno) << std::endl;);
+            }
+            close(racer.output);
+            racer.output = -1;
+            int exit_status = 0;
+            waitpid(racer.pid, &exit_status, 0);
+            racer.pid = -1;
+            running -= 1;
+            ESolverStatus status = SolverCommand::parse_status(racer.response);
+            TRACE("solver", tout << racer.command->name << " responded:" << std::endl << racer.response;);
+            if (status == ESolverStatus::SAT || status == ESolverStatus::UNSAT) {
+                winner = fd_racers[f];
+                result = status;
+            } else if (status == ESolverStatus::UNKNOWN) {
+                result = status;
+            } else if (limits.memory_bytes != 0) {
+                // most likely out of memory, whether it was killed or gave up by itself
+                TRACE("solver", tout << racer.command->name << " ended without an answer (status " << exit_status << ")" << std::endl;);
+                result = ESolverStatus::UNKNOWN;
+            } else {
+                TRACE("solver", tout << "error: " << racer.command->name << " timed out or gave no response" << std::endl;);
+            }
         }
     }
-    // fall through
-    return new BinaryOp("bvshl", (SMT2Expression*)bv, (SMT2Expression*)shiftamt);
-}
-
-Expression * ASTManager_SMT2::mk_bv_logical_right_shift(Expression * bv, Expression * shiftamt) {
-    if (bv->is_concrete() && shiftamt->is_concrete()) {
-        uint32_t bv_val = bv->get_value();
-        uint32_t shiftamt_val = shiftamt->get_value();
-        if (bv->get_width() == 8 && shiftamt->get_width() == 8) {
-            return new ByteConstant( (uint8_t) ((bv_val >> shiftamt_val) & get_bitmask(8)));
-        } else if (bv->get_width() == 16 && shiftamt->get_width() == 16) {
-            return new HalfwordConstant( (uint16_t) ((bv_val >> shiftamt_val) & get_bitmask(16)));
+    // stop the solvers that are still working
+    for (size_t i = 0; i < racers.size(); ++i) {
+        if (racers[i].output != -1) {
+            close(racers[i].output);
+        }
+        if (racers[i].pid != -1) {
+            kill(racers[i].pid, SIGKILL);
+            waitpid(racers[i].pid, NULL, 0);
         }
     }
-    // fall through
-    return new BinaryOp("bvlshr", (SMT2Expression*)bv, (SMT2Expression*)shiftamt);
-}
-
-Expression * ASTManager_SMT2::mk_bv_unsigned_less_than(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value() & get_bitmask(arg0->get_width());
-        uint32_t val1 = arg1->get_value() & get_bitmask(arg1->get_width());
-        return new BooleanConstant(val0 < val1);
-    } else {
-        return new BinaryOp("bvult", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+    if (winner == -1) {
+        return result;
     }
-}
-
-Expression * ASTManager_SMT2::mk_bv_unsigned_less_than_or_equal(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value() & get_bitmask(arg0->get_width());
-        uint32_t val1 = arg1->get_value() & get_bitmask(arg1->get_width());
-        return new BooleanConstant(val0 <= val1);
-    } else {
-        return new BinaryOp("bvule", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+    TRACE("solver", tout << racers[winner].command->name << " answered first" << std::endl;);
+    if (result == ESolverStatus::SAT && want_model) {
+        if (!racers[winner].command->parse_model(racers[winner].response, *model)) {
+            throw "unknown value encoding";
+        }
     }
+    return result;
 }
 
-Expression * ASTManager_SMT2::mk_bv_unsigned_greater_than(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value() & get_bitmask(arg0->get_width());
-        uint32_t val1 = arg1->get_value() & get_bitmask(arg1->get_width());
-        return new BooleanConstant(val0 > val1);
-    } else {
-        return new BinaryOp("bvugt", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+ESolverStatus ASTManager_SMT2::call_solver(std::vector<Expression> & assertions, Model ** model) {
+    // the assertions are the same for every solver; only the boilerplate around them differs
+    std::string instance;
+    {
+        SMT2Writer out(instance);
+        write_instance(out, assertions);
+        out.flush();
     }
+    TRACE("solver", tout << instance;);
+    return race_solvers(m_solver_commands, instance, m_active_limits, (model != NULL) ? *model : NULL);
 }
 
-Expression * ASTManager_SMT2::mk_bv_unsigned_greater_than_or_equal(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        uint32_t val0 = arg0->get_value() & get_bitmask(arg0->get_width());
-        uint32_t val1 = arg1->get_value() & get_bitmask(arg1->get_width());
-        return new BooleanConstant(val0 >= val1);
-    } else {
-        return new BinaryOp("bvuge", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
+bool ASTManager_SMT2::submit_query(SolverQuery & query, std::shared_future<ESolverStatus> & answer) {
+    if (m_solver_pool == NULL) {
+        return false;
     }
-}
-
-Expression * ASTManager_SMT2::mk_bv_signed_less_than(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            int8_t val0 = (int8_t)(arg0->get_value()& get_bitmask(8));
-            int8_t val1 = (int8_t)(arg1->get_value()& get_bitmask(8));
-            return new BooleanConstant(val0 < val1);
-        } else if (arg0->get_width() == 16 && arg1->get_width() == 16) {
-            int16_t val0 = (int16_t)(arg0->get_value()& get_bitmask(16));
-            int16_t val1 = (int16_t)(arg1->get_value()& get_bitmask(16));
-            return new BooleanConstant(val0 < val1);
+    // everything the worker needs is copied now; it must not touch the manager
+    std::vector<Expression> assertions(query.path);
+    assertions.push_back(query.condition);
+    std::string instance;
+    {
+        SMT2Writer out(instance);
+        write_instance(out, assertions);
+        out.flush();
+    }
+    TRACE("solver", tout << "submitting query:" << std::endl << instance;);
+    std::vector<SolverCommand> commands(m_solver_commands);
+    SolverLimits limits = m_query_limits.scaled(query.effort);
+    answer = m_solver_pool->submit([commands, instance, limits]() { return race_solvers(commands, instance, limits, NULL); }).share();
+    return true;
+}
+
+bool ASTManager_SMT2::start_session() {
+    int input;
+    int output;
+    pid_t pid = m_solver_commands.front().spawn(false, m_active_limits.memory_bytes, input, output);
+    if (pid == -1) {
+        return false;
+    }
+    m_session_pid = pid;
+    m_session_input = input;
+    m_session_output = output;
+    m_session_buffer.clear();
+    TRACE("solver", tout << "started solver session " << pid << std::endl;);
+    try {
+        SMT2Writer out(m_session_input);
+        TRACE_CODE(if (is_trace_enabled("solver")) { out.set_echo(&tout); });
+        out.write("(set-logic QF_BV)\n");
+        out.flush();
+    } catch (const char * msg) {
+        TRACE("solver", tout << "error: " << msg << std::endl;);
+        stop_session();
+        return false;
+    }
+    return true;
+}
+
+void ASTManager_SMT2::stop_session() {
+    if (m_session_pid == -1) {
+        return;
+    }
+    close(m_session_input);
+    close(m_session_output);
+    kill(m_session_pid, SIGKILL);
+    waitpid(m_session_pid, NULL, 0);
+    m_session_pid = -1;
+    m_session_input = -1;
+    m_session_output = -1;
+    m_session_buffer.clear();
+    m_session_path.clear();
+    m_session_names.clear();
+    m_session_declared.clear();
+    m_session_defined.clear();
+}
+
+// open a new level and assert 'assertion' in it
+void ASTManager_SMT2::push_session(Expression assertion, SMT2Writer & out) {
+    out.write("(push 1)\n");
+    m_session_names.push_back(std::vector<uint32_t>());
+    std::vector<Expression> assertions(1, assertion);
+    write_assertions(out, assertions, m_session_declared, m_session_defined, m_session_names.back());
+}
+
+// close the innermost 'levels' levels, forgetting the names they introduced
+void ASTManager_SMT2::pop_session(size_t levels, SMT2Writer & out) {
+    for (size_t i = 0; i < levels; ++i) {
+        out.write("(pop 1)\n");
+        std::vector<uint32_t> & names = m_session_names.back();
+        for (std::vector<uint32_t>::iterator it = names.begin(); it != names.end(); ++it) {
+            m_session_declared.erase(*it);
+            m_session_defined.erase(*it);
         }
+        m_session_names.pop_back();
     }
-    // fall through
-    return new BinaryOp("bvslt", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
 }
 
-Expression * ASTManager_SMT2::mk_bv_signed_less_than_or_equal(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            int8_t val0 = (int8_t)(arg0->get_value()& get_bitmask(8));
-            int8_t val1 = (int8_t)(arg1->get_value()& get_bitmask(8));
-            return new BooleanConstant(val0 <= val1);
-        } else if (arg0->get_width() == 16 && arg1->get_width() == 16) {
-            int16_t val0 = (int16_t)(arg0->get_value()& get_bitmask(16));
-            int16_t val1 = (int16_t)(arg1->get_value()& get_bitmask(16));
-            return new BooleanConstant(val0 <= val1);
+/*
+ * Read the next non-empty line of the session's response. Waits at most 'timeout_ms'
+ * milliseconds in total (0 waits indefinitely); on timeout, errno is ETIMEDOUT.
+ */
+bool ASTManager_SMT2::read_session_line(std::string & line, unsigned int timeout_ms) {
+    char buf[2048];
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+        + std::chrono::milliseconds(timeout_ms);
+    for (;;) {
+        size_t newline = m_session_buffer.find('\n');
+        if (newline != std::string::npos) {
+            line = m_session_buffer.substr(0, newline);
+            m_session_buffer.erase(0, newline + 1);
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.resize(line.size() - 1);
+            }
+            if (line.empty()) {
+                continue;
+            }
+            return true;
         }
-    }
-    // fall through
-    return new BinaryOp("bvsle", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
-}
-
-Expression * ASTManager_SMT2::mk_bv_signed_greater_than(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            int8_t val0 = (int8_t)(arg0->get_value()& get_bitmask(8));
-            int8_t val1 = (int8_t)(arg1->get_value()& get_bitmask(8));
-            return new BooleanConstant(val0 > val1);
-        } else if (arg0->get_width() == 16 && arg1->get_width() == 16) {
-            int16_t val0 = (int16_t)(arg0->get_value()& get_bitmask(16));
-            int16_t val1 = (int16_t)(arg1->get_value()& get_bitmask(16));
-            return new BooleanConstant(val0 > val1);
+        if (timeout_ms != 0) {
+            std::chrono::steady_clock::duration remaining = deadline - std::chrono::steady_clock::now();
+            struct pollfd fd;
+            fd.fd = m_session_output;
+            fd.events = POLLIN;
+            fd.revents = 0;
+            int ready = poll(&fd, 1, std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count()));
+            if (ready == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                TRACE("solver", tout << "could not wait for solver response: " << std::strerror(errno) << std::endl;);
+                return false;
+            } else if (ready == 0) {
+                errno = ETIMEDOUT;
+                return false;
+            }
         }
-    }
-    // fall through
-    return new BinaryOp("bvsgt", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
-}
-
-Expression * ASTManager_SMT2::mk_bv_signed_greater_than_or_equal(Expression * arg0, Expression * arg1) {
-    if (arg0->is_concrete() && arg1->is_concrete()) {
-        if (arg0->get_width() == 8 && arg1->get_width() == 8) {
-            int8_t val0 = (int8_t)(arg0->get_value()& get_bitmask(8));
-            int8_t val1 = (int8_t)(arg1->get_value()& get_bitmask(8));
-            return new BooleanConstant(val0 >= val1);
-        } else if (arg0->get_width() == 16 && arg1->get_width() == 16) {
-            int16_t val0 = (int16_t)(arg0->get_value()& get_bitmask(16));
-            int16_t val1 = (int16_t)(arg1->get_value()& get_bitmask(16));
-            return new BooleanConstant(val0 >= val1);
+        ssize_t bytes_read = read(m_session_output, buf, sizeof(buf));
+        if (bytes_read == 0) {
+            errno = 0;
+            return false;
+        } else if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            TRACE("solver", tout << "could not read solver response: " << std::strerror(errno) << std::endl;);
+            return false;
         }
+        m_session_buffer.append(buf, bytes_read);
     }
-    // fall through
-    return new BinaryOp("bvsge", (SMT2Expression*)arg0, (SMT2Expression*)arg1);
 }
 
-ESolverStatus ASTManager_SMT2::call_solver(std::vector<Expression*> & assertions, Model ** model) {
-    std::string instance;
-
-    // start with the usual boilerplate
-    instance = "(set-logic QF_BV)\n";
-
-    // now declare all variables
-    std::map<std::string, SMT2Expression*> variables;
-
-    for (std::vector<Expression*>::iterator it = assertions.begin(); it != assertions.end(); ++it) {
-        SMT2Expression * expr = (SMT2Expression*)*it;
-        expr->collect_variables(variables);
+ESolverStatus ASTManager_SMT2::solve_assuming(std::vector<Expression> & path, Expression condition, Model ** model) {
+    if (model != NULL) {
+        // the session does not retrieve models; ask a fresh solver instead
+        return ASTManager::solve_assuming(path, condition, model);
     }
-
-    for (std::map<std::string, SMT2Expression*>::iterator it = variables.begin(); it != variables.end(); ++it) {
-        SMT2Expression * var = it->second;
-        instance += get_var_decl(var);
-        instance += "\n";
+    if (m_session_pid == -1) {
+        if (!start_session()) {
+            return ESolverStatus::ERROR;
+        }
     }
-
-    // turn every expression into an assertion
-    for (std::vector<Expression*>::iterator it = assertions.begin(); it != assertions.end(); ++it) {
-        instance += ((SMT2Expression*)mk_assert(*it))->to_string();
-        instance += "\n";
+    std::string status;
+    try {
+        SMT2Writer out(m_session_input);
+        TRACE_CODE(if (is_trace_enabled("solver")) { out.set_echo(&tout); });
+        // keep the longest common prefix of the path that is already asserted
+        size_t common = 0;
+        while (common < m_session_path.size() && common < path.size() && m_session_path[common] == path[common]) {
+            common += 1;
+        }
+        pop_session(m_session_path.size() - common, out);
+        m_session_path.resize(common);
+        for (size_t i = common; i < path.size(); ++i) {
+            push_session(path[i], out);
+            m_session_path.push_back(path[i]);
+        }
+        // the condition only lives for this query
+        push_session(condition, out);
+        out.write("(check-sat)\n");
+        pop_session(1, out);
+        out.flush();
+    } catch (const char * msg) {
+        TRACE("solver", tout << "error: " << msg << std::endl;);
+        stop_session();
+        return ESolverStatus::ERROR;
+    }
+    if (!read_session_line(status, m_active_limits.timeout_ms)) {
+        bool timed_out = (errno == ETIMEDOUT);
+        stop_session();
+        if (timed_out) {
+            TRACE("solver", tout << "solver session timed out after " << m_active_limits.timeout_ms << " ms" << std::endl;);
+            return ESolverStatus::UNKNOWN;
+        } else if (m_active_limits.memory_bytes != 0) {
+            // most likely killed for exceeding its memory limit
+            TRACE("solver", tout << "solver session ended without a response" << std::endl;);
+            return ESolverStatus::UNKNOWN;
+        }
+        TRACE("solver", tout << "error: solver session gave no response" << std::endl;);
+        return ESolverStatus::ERROR;
+    }
+    TRACE("solver", tout << status << std::endl;);
+    if (status == "sat") {
+        return ESolverStatus::SAT;
+    } else if (status == "unsat") {
+        return ESolverStatus::UNSAT;
+    } else if (status == "unknown") {
+        return ESolverStatus::UNKNOWN;
+    } else {
+        TRACE("solver", tout << "error: solver returned '" << status << "' but we were hoping for 'sat' or 'unsat'" << std::endl;);
+        stop_session();
+        return ESolverStatus::ERROR;
     }
+}
 
-    // here we assume that STP is being used -- for any other solver we could do (get-model)
-    instance += "(check-sat)\n(exit)\n";
-
-    TRACE("solver", tout << instance << std::endl;);
+/*
+ * Write the declarations and assertions of a one-shot instance for 'assertions' to 'out';
+ * the solver-specific boilerplate around them comes from its SolverCommand.
+ */
+void ASTManager_SMT2::write_instance(SMT2Writer & out, std::vector<Expression> & assertions) {
+    std::unordered_set<uint32_t> declared;
+    std::unordered_set<uint32_t> defined;
+    std::vector<uint32_t> introduced;
 
-    int p_solver_input[2];
-    int p_solver_output[2];
-    pid_t pid;
+    write_assertions(out, assertions, declared, defined, introduced);
+}
 
-    if (pipe(p_solver_input) == -1 || pipe(p_solver_output) == -1) {
-        TRACE("solver", tout << "failed to create pipe: " << std::strerror(errno) << std::endl;);
-        throw std::strerror(errno);
-    }
-    pid = fork();
-    if (pid == -1) {
-        TRACE("solver", tout << "could not fork solver process: " << std::strerror(errno) << std::endl;);
-        throw std::strerror(errno);
-    } else if (pid == 0) {
-        // child process -- run the solver
-        // close write end of input pipe and read end of output pipe
-        close(p_solver_input[1]);
-        close(p_solver_output[0]);
-        // make stdin the same as the solver input
-        dup2(p_solver_input[0], 0);
-        // make stdout the same as the solver output
-        dup2(p_solver_output[1], 1);
-
-        execlp("stp", "stp", "--print-counterex", "--SMTLIB2", NULL);
-        // if we got here, this is bad
-        perror("solver subprocess");
-        _exit(1);
-    } else {
-        // parent process
-        // close read end of input pipe and write end of output pipe
-        close(p_solver_input[0]);
-        close(p_solver_output[1]);
-        const char * buffer = instance.c_str();
-        size_t bytes_remaining = sizeof(char) * instance.size();
-        while (bytes_remaining > 0) {
-            ssize_t bytes_written = write(p_solver_input[1], buffer, bytes_remaining);
-            if (bytes_written == -1) {
-                // error
-                TRACE("solver", tout << "could not write instance: " << std::strerror(errno) << std::endl;);
-                throw std::strerror(errno);
-            } else {
-                bytes_remaining -= bytes_written;
-                buffer += bytes_written;
-            }
+/*
+ * Declare, define and assert 'assertions'.
+ * Every node of the DAG is visited once. Variables not yet in 'declared' are declared,
+ * and operator nodes that occur more than once are named with (define-fun) and referred
+ * to by name afterwards, so shared subterms are printed only once. Terms already in
+ * 'defined' are referred to by name and not visited. Every new name is added to
+ * 'declared' or 'defined' and appended to 'introduced'.
+ */
+void ASTManager_SMT2::write_assertions(SMT2Writer & out, std::vector<Expression> & assertions,
+        std::unordered_set<uint32_t> & declared, std::unordered_set<uint32_t> & defined,
+        std::vector<uint32_t> & introduced) {
+    // number of references to each node within these assertions
+    std::unordered_map<uint32_t, uint32_t> references;
+    // operator nodes in post-order, so children come before their parents
+    std::vector<uint32_t> order;
+    std::map<std::string, uint32_t> variables;
+    std::vector<uint32_t> roots;
+
+    std::vector<std::pair<uint32_t, unsigned int> > stack;
+    for (std::vector<Expression>::iterator it = assertions.begin(); it != assertions.end(); ++it) {
+        uint32_t root = to_node(*it);
+        roots.push_back(root);
+        if (++references[root] > 1 || defined.count(root) != 0) {
+            continue;
         }
-        // send EOF
-        close(p_solver_input[1]);
-
-        // read buffer into string
-        char out_buf[2048];
-        std::string solver_response;
-        while(true) {
-            ssize_t bytes_read = read(p_solver_output[0], out_buf, 2048);
-            if (bytes_read == 0) {
-                break;
-            } else if (bytes_read == -1) {
-                // error
-                TRACE("solver", tout << "could not read solver response: " << std::strerror(errno) << std::endl;);
-                throw std::strerror(errno);
+        stack.push_back(std::make_pair(root, 0u));
+        while (!stack.empty()) {
+            uint32_t id = stack.back().first;
+            const ExpressionNode & node = get_node(id);
+            if (stack.back().second < node.num_args) {
+                uint32_t child = node.args[stack.back().second];
+                stack.back().second += 1;
+                if (++references[child] == 1 && defined.count(child) == 0) {
+                    stack.push_back(std::make_pair(child, 0u));
+                }
             } else {
-                solver_response.append(out_buf, bytes_read);
+                if (node.op == OP_VAR) {
+                    if (declared.count(id) == 0) {
+                        variables[get_variable_name(id)] = id;
+                    }
+                } else if (node.num_args > 0) {
+                    order.push_back(id);
+                }
+                stack.pop_back();
             }
         }
-        close(p_solver_output[0]);
-
-        // now interpret solver response
-        std::stringstream response_stream(solver_response);
-        std::string item;
-        std::vector<std::string> response_tokens;
-        while(std::getline(response_stream, item)) {
-            response_tokens.push_back(item);
-        }
+    }
 
-        if (response_tokens.empty()) {
-            TRACE("solver", tout << "error: solver timed out or gave no response" << std::endl;);
-            return ESolverStatus::ERROR;
+    // declare new variables
+    for (std::map<std::string, uint32_t>::iterator it = variables.begin(); it != variables.end(); ++it) {
+        write_var_decl(out, it->second);
+        out.write('\n');
+        declared.insert(it->second);
+        introduced.push_back(it->second);
+    }
+
+    // name shared subterms
+    for (std::vector<uint32_t>::iterator it = order.begin(); it != order.end(); ++it) {
+        if (references[*it] < 2) {
+            continue;
         }
+        const ExpressionNode & node = get_node(*it);
+        out.write("(define-fun e!");
+        out.write_uint(*it);
+        out.write(" () ");
+        if (is_boolean(get_expression(*it))) {
+            out.write("Bool");
+        } else {
+            out.write("(_ BitVec ");
+            out.write_uint(node.width);
+            out.write(')');
+        }
+        out.write(' ');
+        write_term(out, *it, &defined);
+        out.write(")\n");
+        defined.insert(*it);
+        introduced.push_back(*it);
+    }
 
-        TRACE("solver",
-                for (std::vector<std::string>::iterator it = response_tokens.begin(); it != response_tokens.end(); ++it) {
-                    tout << *it << std::endl;
-                }
-        );
-        // we expect the status to be the very last response line
-        std::string status = response_tokens.at(response_tokens.size() - 1);
-        if (status == "sat") {
-            // the following is so STP-specific that it isn't even funny
-            if (model != NULL) {
-                // ASSERT( foo = 0x01 );
-                for (std::vector<std::string>::iterator it = response_tokens.begin(); it != response_tokens.end(); ++it) {
-                    std::string assertion = *it;
-                    std::stringstream assertion_stream(assertion);
-                    std::string token;
-                    std::vector<std::string> tokens;
-                    while (std::getline(assertion_stream, token, ' ')) {
-                        tokens.push_back(token);
-                    }
-                    if (tokens.empty()) {
-                        continue;
-                    }
-                    if (tokens.at(0) != "ASSERT(") {
-                        continue;
-                    }
-                    std::string var_name = tokens.at(1);
-                    std::string var_val = tokens.at(3);
-                    TRACE("solver", tout << "set " << var_name << " = " << var_val << std::endl;);
-                    // parse var_val, figure out its width
-                    // so far I've seen 0b[binary constant] and 0x[hex constant]
-                    if (var_val.substr(0, 2) == "0x") {
-                        // hex constant
-                        long int val = strtol(var_val.substr(2).c_str(), NULL, 16);
-                        (*model)->add_variable(var_name, val, 4 * (var_val.length() - 2));
-                    } else if (var_val.substr(0, 2) == "0b") {
-                        // binary constant
-                        long int val = strtol(var_val.substr(2).c_str(), NULL, 2);
-                        (*model)->add_variable(var_name, val, (var_val.length() - 2));
-                    } else {
-                        throw "unknown value encoding";
-                    }
-                }
-            }
-            return ESolverStatus::SAT;
-        } else if (status == "unsat") {
-            return ESolverStatus::UNSAT;
+    // turn every expression into an assertion
+    for (std::vector<uint32_t>::iterator it = roots.begin(); it != roots.end(); ++it) {
+        out.write("(assert ");
+        if (defined.count(*it) != 0) {
+            out.write("e!");
+            out.write_uint(*it);
         } else {
-            TRACE("solver", tout << "error: solver returned '" << status << "' but we were hoping for 'sat' or 'unsat'" << std::endl;);
-            return ESolverStatus::ERROR;
+            write_term(out, *it, &defined);
         }
+        out.write(")\n");
     }
 }
 
@@ -754,13 +685,74 @@ ESolverStatus ASTManager_SMT2::call_solver(std::vector<Expression*> & assertions
  * use the slightly more verbose (declare-fun), which we hope
  * everyone supports (at least STP and Z3 do).
  */
-std::string ASTManager_SMT2::get_var_decl(Expression * var) {
-    // TODO throw an exception if 'var' is not actually a BitVectorVariable
-    BitVectorVariable * bv_var = (BitVectorVariable*)var;
-    std::string decl = "(declare-fun ";
-    decl += bv_var->to_string();
-    decl += " () (_ BitVec ";
-    decl += std::to_string(bv_var->get_width());
-    decl += "))";
-    return decl;
+void ASTManager_SMT2::write_var_decl(SMT2Writer & out, uint32_t var) {
+    const ExpressionNode & node = get_node(var);
+    if (node.op != OP_VAR) {
+        throw "not a variable";
+    }
+    out.write("(declare-fun ");
+    out.write(get_variable_name(var));
+    out.write(" () (_ BitVec ");
+    out.write_uint(node.width);
+    out.write("))");
+}
+
+/*
+ * Write the term rooted at 'id'. Subterms in 'defined' are written by name;
+ * if 'defined' is NULL, the term is written out in full.
+ */
+void ASTManager_SMT2::write_term(SMT2Writer & out, uint32_t id, const std::unordered_set<uint32_t> * defined) {
+    const ExpressionNode & node = get_node(id);
+    switch (node.op) {
+    case OP_BOOL_CONST:
+        out.write((node.args[0] != 0) ? "true" : "false");
+        break;
+    case OP_BV_CONST:
+        write_bv_constant(out, ((uint64_t)node.args[1] << 32) | node.args[0], node.width);
+        break;
+    case OP_INT_CONST:
+        if ((int32_t)node.args[0] < 0) {
+            out.write('-');
+            out.write_uint(-(int64_t)(int32_t)node.args[0]);
+        } else {
+            out.write_uint(node.args[0]);
+        }
+        break;
+    case OP_VAR:
+        out.write(get_variable_name(id));
+        break;
+    default:
+        out.write('(');
+        if (node.op == OP_BV_EXTRACT) {
+            out.write("(_ extract ");
+            out.write_uint(node.args[1]);
+            out.write(' ');
+            out.write_uint(node.args[2]);
+            out.write(')');
+        } else {
+            out.write(get_opcode_name((EOpcode)node.op));
+        }
+        for (unsigned int i = 0; i < node.num_args; ++i) {
+            uint32_t child = node.args[i];
+            out.write(' ');
+            if (defined != NULL && defined->count(child) != 0) {
+                out.write("e!");
+                out.write_uint(child);
+            } else {
+                write_term(out, child, defined);
+            }
+        }
+        out.write(')');
+        break;
+    }
+}
+
+std::string ASTManager_SMT2::to_string(Expression expr) {
+    std::string str;
+    if (!expr.is_null()) {
+        SMT2Writer out(str);
+        write_term(out, to_node(expr), NULL);
+        out.flush();
+    }
+    return str;
 }
@@ -6,49 +6,34 @@
 #include "context_scheduler.h"
 #include "trace.h"
 
-static Expression * CPU_ReadRAM(Context & ctx, uint8_t bank, uint16_t addr) {
+static Expression CPU_ReadRAM(Context & ctx, uint8_t bank, uint16_t addr) {
     return ctx.cpu_read_ram(addr & 0x07FF);
 }
 
-static void CPU_WriteRAM(Context & ctx, uint8_t bank, uint16_t addr, Expression * val) {
+static void CPU_WriteRAM(Context & ctx, uint8_t bank, uint16_t addr, Expression val) {
     ctx.cpu_write_ram(addr & 0x07FF, val);
 }
 
-Expression * Context::cpu_read_ram(uint16_t addr) {
-    if (m_cpu_ram == NULL) {
-        // check copy-on-write cache, then ask parent
-        std::map<uint16_t, Expression*>::iterator target = m_cpu_ram_copyonwrite.find(addr);
-        if (target == m_cpu_ram_copyonwrite.end()) {
-            return m_parent_context->cpu_read_ram(addr);
-        } else {
-            return target->second;
-        }
-    } else {
-        return m_cpu_ram[addr];
-    }
+Expression Context::cpu_read_ram(uint16_t addr) {
+    return m_cpu_ram.read(addr);
 }
 
-void Context::cpu_write_ram(uint16_t addr, Expression * value) {
-    if (m_cpu_ram == NULL) {
-        // only write to copy-on-write cache
-        m_cpu_ram_copyonwrite[addr] = value;
-    } else {
-        m_cpu_ram[addr] = value;
-    }
+void Context::cpu_write_ram(uint16_t addr, Expression value) {
+    m_cpu_ram.write(addr, value);
 }
 
-static Expression * PPU_IntRead(Context & ctx, uint8_t bank, uint16_t addr) {
+static Expression PPU_IntRead(Context & ctx, uint8_t bank, uint16_t addr) {
     // TODO PPU_IntRead
-    return NULL;
+    return Expression();
 }
 
-static void PPU_IntWrite(Context & ctx, uint8_t bank, uint16_t addr, Expression * val) {
+static void PPU_IntWrite(Context & ctx, uint8_t bank, uint16_t addr, Expression val) {
     // TODO PPU_IntWrite
 }
 
-static Expression * APU_IntRead(Context & ctx, uint8_t bank, uint16_t addr) {
+static Expression APU_IntRead(Context & ctx, uint8_t bank, uint16_t addr) {
     ASTManager & m = ctx.get_manager();
-    Expression * result = m.mk_byte(0xFF);
+    Expression result = m.mk_byte(0xFF);
     switch (addr) {
     /*
      * In general, controller reads are done like this:
@@ -71,7 +56,7 @@ static Expression * APU_IntRead(Context & ctx, uint8_t bank, uint16_t addr) {
     return result;
 }
 
-static void APU_IntWrite(Context & ctx, uint8_t bank, uint16_t addr, Expression * val) {
+static void APU_IntWrite(Context & ctx, uint8_t bank, uint16_t addr, Expression val) {
     switch (addr) {
     case 0x016:
         ctx.controller_write(val);
@@ -79,28 +64,31 @@ static void APU_IntWrite(Context & ctx, uint8_t bank, uint16_t addr, Expression
     }
 }
 
-static Expression * CPU_ReadPRG(Context & ctx, uint8_t bank, uint16_t addr) {
+static Expression CPU_ReadPRG(Context & ctx, uint8_t bank, uint16_t addr) {
     TRACE("read_prg", tout << "bank = " << std::to_string(bank) << ", addr = " << std::to_string(addr) << std::endl;);
-    if (ctx.get_cpu_readable()[bank]) {
-        return ctx.get_cpu_PRG_pointer()[bank][addr];
-    } else {
-        return NULL;
+    if (!ctx.get_cpu_readable()[bank]) {
+        return Expression();
+    }
+    if (ctx.get_cpu_PRG_pointer()[bank] == NULL) {
+        return ctx.get_cpu_PRG_RAM().read(ctx.get_cpu_PRG_RAM_bank()[bank] * 0x1000 + addr);
     }
+    return ctx.get_manager().mk_byte(ctx.get_cpu_PRG_pointer()[bank][addr]);
 }
 
-static void CPU_WritePRG(Context & ctx, uint8_t bank, uint16_t addr, Expression * val) {
+// only banks of PRG RAM are writable
+static void CPU_WritePRG(Context & ctx, uint8_t bank, uint16_t addr, Expression val) {
     if (ctx.get_cpu_writable()[bank]) {
-        ctx.get_cpu_PRG_pointer()[bank][addr] = val;
+        ctx.get_cpu_PRG_RAM().write(ctx.get_cpu_PRG_RAM_bank()[bank] * 0x1000 + addr, val);
     }
 }
 
 Context::Context(ASTManager & m, ContextScheduler & sch)
-: m(m), sch(sch), m_parent_context(NULL), m_has_forked(false),
+: m(m), sch(sch), m_parent_context(NULL), m_references(1), m_has_forked(false), m_unknown_answers(0), m_feasibility_unknown(false),
   m_step_count(0), m_next_device(EDevice::Device_CPU), m_frame_number(0),
   m_mapper(NULL),
   m_mapper_prg_size_ram(0), m_mapper_prg_size_rom(0),
   m_mapper_chr_size_ram(0), m_mapper_chr_size_rom(0),
-  m_PRG_ROM(NULL), m_CHR_ROM(NULL),
+  m_rom_image(NULL), m_PRG_ROM(NULL), m_CHR_ROM(NULL),
   // CPU
   m_cpu_cycle_count(0), m_cpu_pcm_cycles(0), m_cpu_current_opcode(0),
   m_cpu_state(ECPUState::CPU_Reset1), m_cpu_memory_phase(true),
@@ -109,11 +97,13 @@ Context::Context(ASTManager & m, ContextScheduler & sch)
   m_cpu_A(m.mk_byte(0)), m_cpu_X(m.mk_byte(0)), m_cpu_Y(m.mk_byte(0)), m_cpu_SP(m.mk_byte(0)), m_cpu_PC(m.mk_halfword(0)),
   m_cpu_FC(m.mk_byte(0)), m_cpu_FZ(m.mk_byte(0)), m_cpu_FI(m.mk_byte(0)),
   m_cpu_FD(m.mk_byte(0)), m_cpu_FV(m.mk_byte(0)), m_cpu_FN(m.mk_byte(0)),
-  m_cpu_last_read(m.mk_byte(0)), m_cpu_calc_addr(NULL), m_cpu_branch_offset(NULL),
+  m_cpu_last_read(m.mk_byte(0)), m_cpu_calc_addr(), m_cpu_branch_offset(),
   // Controllers
-  m_controller1_bits(NULL), m_controller1_bit_ptr(0), m_controller1_strobe(false), m_controller1_seqno(0),
+  m_controller1_bits(), m_controller1_bit_ptr(0), m_controller1_strobe(false), m_controller1_seqno(0),
   // start the read for Reset1
-  m_cpu_address(m.mk_halfword(0)), m_cpu_write_enable(false), m_cpu_data_out(m.mk_byte(0))
+  m_cpu_address(m.mk_halfword(0)), m_cpu_write_enable(false), m_cpu_data_out(m.mk_byte(0)),
+  // RAM starts out zeroed
+  m_cpu_ram(0x800), m_cpu_prg_ram(0, DIGEST_PRG_RAM)
 {
     // *** CPU initialization ***
 
@@ -123,6 +113,8 @@ Context::Context(ASTManager & m, ContextScheduler & sch)
         m_cpu_write_handler[i] = CPU_WritePRG;
         m_cpu_readable[i] = false;
         m_cpu_writable[i] = false;
+        m_cpu_prg_pointer[i] = NULL;
+        m_cpu_prg_ram_bank[i] = 0;
     }
 
     m_cpu_read_handler[0] = CPU_ReadRAM; m_cpu_write_handler[0] = CPU_WriteRAM;
@@ -134,20 +126,16 @@ Context::Context(ASTManager & m, ContextScheduler & sch)
 
     m_cpu_read_handler[4] = APU_IntRead; m_cpu_write_handler[4] = APU_IntWrite;
 
-    // zero RAM
-    m_cpu_ram = new Expression*[0x800];
-    for (unsigned int i = 0; i < 0x800; ++i) {
-        m_cpu_ram[i] = m.mk_byte(0);
-    }
 }
 
 Context::Context(ASTManager & m, Context * parent)
-: m(m), sch(parent->get_scheduler()), m_parent_context(parent), m_has_forked(false),
+: m(m), sch(parent->get_scheduler()), m_parent_context(parent), m_references(1), m_has_forked(false), m_unknown_answers(0), m_feasibility_unknown(false),
+  m_path(parent->m_path),
   m_step_count(parent->m_step_count), m_next_device(parent->m_next_device), m_frame_number(parent->m_frame_number),
   m_mapper(parent->m_mapper),
   m_mapper_prg_size_ram(parent->m_mapper_prg_size_ram), m_mapper_prg_size_rom(parent->m_mapper_prg_size_rom),
   m_mapper_chr_size_ram(parent->m_mapper_chr_size_ram), m_mapper_chr_size_rom(parent->m_mapper_chr_size_rom),
-  m_PRG_ROM(parent->m_PRG_ROM), m_CHR_ROM(parent->m_CHR_ROM),
+  m_rom_image(NULL), m_PRG_ROM(parent->m_PRG_ROM), m_CHR_ROM(parent->m_CHR_ROM),
   // CPU
   m_cpu_cycle_count(parent->m_cpu_cycle_count), m_cpu_pcm_cycles(parent->m_cpu_pcm_cycles), m_cpu_current_opcode(parent->m_cpu_current_opcode),
   m_cpu_state(parent->m_cpu_state), m_cpu_memory_phase(parent->m_cpu_memory_phase),
@@ -162,8 +150,12 @@ Context::Context(ASTManager & m, Context * parent)
   m_controller1_bits(parent->m_controller1_bits), m_controller1_bit_ptr(parent->m_controller1_bit_ptr),
   m_controller1_strobe(parent->m_controller1_strobe), m_controller1_seqno(parent->m_controller1_seqno),
   // Address Bus
-  m_cpu_address(parent->m_cpu_address), m_cpu_write_enable(parent->m_cpu_write_enable), m_cpu_data_out(parent->m_cpu_data_out)
+  m_cpu_address(parent->m_cpu_address), m_cpu_write_enable(parent->m_cpu_write_enable), m_cpu_data_out(parent->m_cpu_data_out),
+  // RAM
+  m_cpu_ram(parent->m_cpu_ram), m_cpu_prg_ram(parent->m_cpu_prg_ram)
 {
+    // the parent must outlive us
+    parent->retain();
 
     // *** CPU initialization ***
     // CPU read/write handlers
@@ -173,18 +165,49 @@ Context::Context(ASTManager & m, Context * parent)
         m_cpu_readable[i] = parent->m_cpu_readable[i];
         m_cpu_writable[i] = parent->m_cpu_writable[i];
         m_cpu_prg_pointer[i] = parent->m_cpu_prg_pointer[i];
+        m_cpu_prg_ram_bank[i] = parent->m_cpu_prg_ram_bank[i];
     }
+}
 
-    m_cpu_ram = NULL;
+void Context::retain() {
+    m_references += 1;
+}
+
+void Context::release() {
+    // walk up iteratively; a long chain of forks must not recurse once per level
+    Context * ctx = this;
+    while (ctx != NULL) {
+        ctx->m_references -= 1;
+        if (ctx->m_references != 0) {
+            break;
+        }
+        Context * parent = ctx->m_parent_context;
+        delete ctx;
+        ctx = parent;
+    }
 }
 
 Context::~Context() {
+    if (m_parent_context == NULL) {
+        // the root context owns the cartridge, which all of its descendants share
+        delete m_mapper;
+        delete m_rom_image;
+    }
+}
+
+void Context::load_iNES(const char * filename) {
+    load_iNES(RomImage::map_file(filename));
 }
 
-void Context::load_iNES(std::istream & in) {
-    int i;
-    char Header[16];
-    in.read(Header, 16);
+void Context::load_iNES(RomImage * image) {
+    // the root context owns the image from here on, even if it turns out to be invalid
+    delete m_rom_image;
+    m_rom_image = image;
+    // the header is checked where it lies
+    const uint8_t * Header = image->get_data();
+    if (image->get_size() < 16) {
+        throw "ROM image is truncated";
+    }
     // check iNES header signature
     if (Header[0] != 'N' || Header[1] != 'E' || Header[2] != 'S' || Header[3] != '\x1A') {
         throw "iNES header signature not found";
@@ -221,40 +244,15 @@ void Context::load_iNES(std::istream & in) {
     m_mapper_prg_size_rom = ines_PRGsize * 0x4;
     m_mapper_chr_size_rom = ines_CHRsize * 0x8;
 
-    m_PRG_ROM = (Expression***)malloc(sizeof(Expression**) * MAX_PRG_ROM_SIZE);
-    for (unsigned int i = 0; i < MAX_PRG_ROM_SIZE; ++i) {
-        m_PRG_ROM[i] = (Expression**)malloc(sizeof(Expression*) * 0x1000);
+    if (m_mapper_prg_size_rom == 0) {
+        throw "ROM image has no PRG ROM";
     }
-
-    m_CHR_ROM = (Expression***)malloc(sizeof(Expression**) * MAX_CHR_ROM_SIZE);
-    for (unsigned int i = 0; i < MAX_CHR_ROM_SIZE; ++i) {
-        m_CHR_ROM[i] = (Expression**)malloc(sizeof(Expression*) * 0x400);
-    }
-
-    char * PRG_ROM_buffer = new char[m_mapper_prg_size_rom * 0x4000];
-    in.read(PRG_ROM_buffer, m_mapper_prg_size_rom * 0x4000);
-    char * CHR_ROM_buffer = new char[m_mapper_chr_size_rom * 0x2000];
-    in.read(CHR_ROM_buffer, m_mapper_chr_size_rom * 0x2000);
-
-    for (unsigned int bank = 0; bank < m_mapper_prg_size_rom * 4; ++bank) {
-        for (unsigned int pos = 0; pos < 0x1000; ++pos) {
-            unsigned int index = bank * 0x1000 + pos;
-            char val = PRG_ROM_buffer[index];
-            m_PRG_ROM[bank][pos] = get_manager().mk_byte(val);
-        }
+    // the banks are exactly as large as the cartridge, and are used straight from the image
+    if (image->get_size() < 16 + (size_t)m_mapper_prg_size_rom * 0x1000 + (size_t)m_mapper_chr_size_rom * 0x400) {
+        throw "ROM image is truncated";
     }
-
-    // TODO initialize CHR ROM
-
-    /*
-    for (unsigned int i = 0; i < m_mapper_prg_size_rom * 0x4000; ++i) {
-        m_PRG_ROM[i] = get_manager().mk_byte(PRG_ROM_buffer[i]);
-    }
-
-    for (unsigned int i = 0; i < m_mapper_chr_size_rom * 0x2000; ++i) {
-        m_CHR_ROM[i] = get_manager().mk_byte(CHR_ROM_buffer[i]);
-    }
-    */
+    m_PRG_ROM = Header + 16;
+    m_CHR_ROM = m_PRG_ROM + m_mapper_prg_size_rom * 0x1000;
 
     uint8_t ines_PRGram_size;
     uint8_t ines_CHRram_size;
@@ -266,6 +264,7 @@ void Context::load_iNES(std::istream & in) {
         ines_PRGram_size = 0x10;
         ines_CHRram_size = 0x20;
     }
+    m_mapper_prg_size_ram = ines_PRGram_size;
 
     // load mapper
     m_mapper = get_mapper(ines_mapper_num, ines_flags);
@@ -273,9 +272,6 @@ void Context::load_iNES(std::istream & in) {
     m_mapper->reset(*this);
 
     // TODO extra stuff for playchoice-10 and vs. unisystem roms to autoselect palette
-
-    delete[] PRG_ROM_buffer;
-    delete[] CHR_ROM_buffer;
 }
 
 
@@ -288,14 +284,311 @@ ContextScheduler & Context::get_scheduler() {
 }
 
 int Context::get_priority() const {
-    // TODO do something here
-    return 0;
+    // contexts the solver struggles with wait behind the others
+    return -(int)m_unknown_answers;
 }
 
 bool Context::has_forked() const {
     return m_has_forked;
 }
 
+Expression Context::* const Context::merged_state[] = {
+    &Context::m_cpu_A, &Context::m_cpu_X, &Context::m_cpu_Y, &Context::m_cpu_SP,
+    &Context::m_cpu_FC, &Context::m_cpu_FZ, &Context::m_cpu_FI,
+    &Context::m_cpu_FD, &Context::m_cpu_FV, &Context::m_cpu_FN,
+    &Context::m_cpu_last_read, &Context::m_cpu_calc_addr, &Context::m_cpu_branch_offset,
+    &Context::m_cpu_data_out
+};
+const size_t Context::num_merged_registers = 10;
+const size_t Context::num_merged_state = sizeof(Context::merged_state) / sizeof(Context::merged_state[0]);
+
+bool Context::is_at_instruction_boundary() const {
+    return m_cpu_state == CPU_Decode;
+}
+
+size_t Context::get_num_live_state() const {
+    return is_at_instruction_boundary() ? num_merged_registers : num_merged_state;
+}
+
+bool Context::can_merge_with(const Context & other) const {
+    if (&other == this || m_parent_context == NULL || other.m_parent_context == NULL) {
+        // the root context owns the cartridge and must not be merged away
+        return false;
+    }
+    if (m_has_forked || other.m_has_forked
+        || is_waiting_for_solver() || other.is_waiting_for_solver()
+        || m_feasibility_unknown || other.m_feasibility_unknown) {
+        return false;
+    }
+    // the point of execution
+    if (m_cpu_cycle_count != other.m_cpu_cycle_count || m_step_count != other.m_step_count
+        || m_next_device != other.m_next_device || m_frame_number != other.m_frame_number
+        || m_cpu_state != other.m_cpu_state || m_cpu_memory_phase != other.m_cpu_memory_phase
+        || m_cpu_pcm_cycles != other.m_cpu_pcm_cycles
+        || m_cpu_want_nmi != other.m_cpu_want_nmi || m_cpu_want_irq != other.m_cpu_want_irq) {
+        return false;
+    }
+    // the instruction in progress; decoding the next one resets all of this
+    if (!is_at_instruction_boundary()
+        && (m_cpu_addressing_mode_state != other.m_cpu_addressing_mode_state
+            || m_cpu_addressing_mode_cycle != other.m_cpu_addressing_mode_cycle
+            || m_cpu_current_opcode != other.m_cpu_current_opcode || m_cpu_execute_cycle != other.m_cpu_execute_cycle)) {
+        return false;
+    }
+    // where the CPU goes next must not depend on the path
+    if (!m_cpu_PC.is_concrete() || m_cpu_PC != other.m_cpu_PC
+        || m_cpu_address != other.m_cpu_address || m_cpu_write_enable != other.m_cpu_write_enable) {
+        return false;
+    }
+    // mapper banks
+    if (m_mapper != other.m_mapper) {
+        return false;
+    }
+    for (unsigned int i = 0; i < 0x10; ++i) {
+        if (m_cpu_read_handler[i] != other.m_cpu_read_handler[i] || m_cpu_write_handler[i] != other.m_cpu_write_handler[i]
+            || m_cpu_prg_pointer[i] != other.m_cpu_prg_pointer[i] || m_cpu_prg_ram_bank[i] != other.m_cpu_prg_ram_bank[i]
+            || m_cpu_readable[i] != other.m_cpu_readable[i] || m_cpu_writable[i] != other.m_cpu_writable[i]) {
+            return false;
+        }
+    }
+    if (m_cpu_prg_ram.get_size() != other.m_cpu_prg_ram.get_size()) {
+        return false;
+    }
+    // controller
+    if (m_controller1_bits != other.m_controller1_bits || m_controller1_bit_ptr != other.m_controller1_bit_ptr
+        || m_controller1_strobe != other.m_controller1_strobe || m_controller1_seqno != other.m_controller1_seqno
+        || m_controller1_inputs != other.m_controller1_inputs) {
+        return false;
+    }
+    // state that differs must have the same sort on both sides
+    for (size_t i = 0; i < get_num_live_state(); ++i) {
+        Expression mine = this->*merged_state[i];
+        Expression theirs = other.*merged_state[i];
+        if (mine == theirs) {
+            continue;
+        }
+        if (mine.is_null() || theirs.is_null() || mine.get_width() != theirs.get_width()
+            || m.is_boolean(mine) != m.is_boolean(theirs)) {
+            return false;
+        }
+    }
+    // each path needs an assumption of its own to tell the two apart
+    size_t common = m_path.get_common_prefix(other.m_path).size();
+    return m_path.size() > common && other.m_path.size() > common;
+}
+
+unsigned int Context::get_merge_cost(const Context & other, unsigned int limit) const {
+    unsigned int cost = 0;
+    for (size_t i = 0; i < get_num_live_state(); ++i) {
+        if (this->*merged_state[i] != other.*merged_state[i]) {
+            cost += 1;
+        }
+    }
+    size_t common = m_path.get_common_prefix(other.m_path).size();
+    cost += (m_path.size() - common) + (other.m_path.size() - common);
+    if (cost > limit) {
+        return cost;
+    }
+    std::vector<uint16_t> cells;
+    if (!m_cpu_ram.find_differences(other.m_cpu_ram, cells, limit - cost)) {
+        return limit + 1;
+    }
+    cost += cells.size();
+    cells.clear();
+    if (!m_cpu_prg_ram.find_differences(other.m_cpu_prg_ram, cells, limit - cost)) {
+        return limit + 1;
+    }
+    return cost + cells.size();
+}
+
+Expression Context::get_path_suffix(const PathCondition & path, size_t prefix_size) const {
+    Expression conjunction = m.mk_bool(true);
+    for (PathCondition p = path; p.size() > prefix_size; p = p.get_prefix()) {
+        conjunction = m.mk_and(p.back(), conjunction);
+    }
+    return conjunction;
+}
+
+// make the cells in which 'ram' and 'other' differ hold whichever value the path taken selects
+static void merge_memory(ASTManager & m, Expression mine, PagedRAM & ram, const PagedRAM & other) {
+    std::vector<uint16_t> cells;
+    ram.find_differences(other, cells, SIZE_MAX);
+    for (std::vector<uint16_t>::iterator it = cells.begin(); it != cells.end(); ++it) {
+        ram.write(*it, m.mk_ite(mine, ram.read(*it), other.read(*it)));
+    }
+}
+
+void Context::merge(const Context & other) {
+    PathCondition common = m_path.get_common_prefix(other.m_path);
+    Expression mine = get_path_suffix(m_path, common.size());
+    Expression theirs = get_path_suffix(other.m_path, common.size());
+    TRACE("merge", tout << "merging contexts at cycle " << m_cpu_cycle_count << ", PC = " << m.to_string(m_cpu_PC)
+            << ", after " << common.size() << " common assumptions" << std::endl;);
+    // dead state is left as this context has it
+    for (size_t i = 0; i < get_num_live_state(); ++i) {
+        Expression & value = this->*merged_state[i];
+        if (value != other.*merged_state[i]) {
+            value = m.mk_ite(mine, value, other.*merged_state[i]);
+        }
+    }
+    merge_memory(m, mine, m_cpu_ram, other.m_cpu_ram);
+    merge_memory(m, mine, m_cpu_prg_ram, other.m_cpu_prg_ram);
+    // the two paths usually split at one branch, whose condition and its negation
+    // make the disjunction trivially true
+    Expression either = m.mk_or(mine, theirs);
+    if (either.is_concrete() && either.get_value() != 0) {
+        m_path = common;
+    } else {
+        m_path = m.extend_path(common, either);
+    }
+    if (other.m_unknown_answers > m_unknown_answers) {
+        m_unknown_answers = other.m_unknown_answers;
+    }
+}
+
+// add the expression in state element 'slot' to 'digest'
+static void add_expression(StateDigest & digest, unsigned int slot, Expression value) {
+    digest.toggle(DIGEST_STATE, (uint64_t)slot | ((uint64_t)value.get_kind() << 16) | ((uint64_t)value.get_width() << 24), value.get_value());
+}
+
+StateDigest Context::get_state_digest() const {
+    StateDigest digest = m_cpu_ram.get_digest();
+    digest ^= m_cpu_prg_ram.get_digest();
+    for (size_t i = 0; i < get_num_live_state(); ++i) {
+        add_expression(digest, i, this->*merged_state[i]);
+    }
+    unsigned int slot = num_merged_state;
+    add_expression(digest, slot++, m_cpu_PC);
+    add_expression(digest, slot++, m_cpu_address);
+    add_expression(digest, slot++, m_controller1_bits);
+    uint64_t phase = (uint64_t)m_cpu_state | ((uint64_t)m_cpu_memory_phase << 8) | ((uint64_t)m_cpu_write_enable << 9)
+        | ((uint64_t)m_cpu_want_nmi << 10) | ((uint64_t)m_cpu_want_irq << 11) | ((uint64_t)m_cpu_pcm_cycles << 16);
+    if (!is_at_instruction_boundary()) {
+        phase |= ((uint64_t)m_cpu_addressing_mode_state << 24) | ((uint64_t)m_cpu_addressing_mode_cycle << 32)
+            | ((uint64_t)m_cpu_current_opcode << 40) | ((uint64_t)m_cpu_execute_cycle << 48);
+    }
+    digest.toggle(DIGEST_STATE, slot++, phase);
+    uint64_t controller = (uint64_t)m_controller1_bit_ptr | ((uint64_t)m_controller1_strobe << 8)
+        | ((uint64_t)m_controller1_seqno << 32);
+    digest.toggle(DIGEST_STATE, slot++, controller);
+    digest.toggle(DIGEST_STATE, slot++, m_frame_number);
+    for (unsigned int i = 0; i < 0x10; ++i) {
+        uint64_t mapping = (m_cpu_prg_pointer[i] != NULL) ? (uint64_t)(uintptr_t)m_cpu_prg_pointer[i] : m_cpu_prg_ram_bank[i];
+        digest.toggle(DIGEST_STATE, slot++, mapping);
+    }
+    return digest;
+}
+
+uint64_t Context::get_state_path_hash() const {
+    if (m_path.empty()) {
+        return 0;
+    }
+    std::vector<Expression> state;
+    for (size_t i = 0; i < get_num_live_state(); ++i) {
+        state.push_back(this->*merged_state[i]);
+    }
+    state.push_back(m_cpu_PC);
+    state.push_back(m_cpu_address);
+    state.push_back(m_controller1_bits);
+    m_cpu_ram.collect_symbolic(state);
+    m_cpu_prg_ram.collect_symbolic(state);
+    std::vector<Expression> relevant;
+    m.get_relevant_assumptions(m_path, state, relevant);
+    uint64_t hash = 0;
+    for (std::vector<Expression>::iterator it = relevant.begin(); it != relevant.end(); ++it) {
+        hash += PathCondition::hash_assumption(*it);
+    }
+    return hash;
+}
+
+const PathCondition & Context::get_path() const {
+    return m_path;
+}
+
+void Context::mark_live(std::unordered_set<const void*> & visited) const {
+    // ancestors are only kept for their children, but their state must stay valid all the same
+    for (const Context * ctx = this; ctx != NULL && visited.insert(ctx).second; ctx = ctx->m_parent_context) {
+        for (size_t i = 0; i < num_merged_state; ++i) {
+            m.mark_live(ctx->*merged_state[i]);
+        }
+        m.mark_live(ctx->m_cpu_PC);
+        m.mark_live(ctx->m_cpu_address);
+        m.mark_live(ctx->m_controller1_bits);
+        for (size_t i = 0; i < ctx->m_controller1_inputs.size(); ++i) {
+            m.mark_live(ctx->m_controller1_inputs[i]);
+        }
+        m.mark_live(ctx->m_feasibility_query);
+        ctx->m_path.mark_live(m, visited);
+        ctx->m_cpu_ram.mark_live(m, visited);
+        ctx->m_cpu_prg_ram.mark_live(m, visited);
+    }
+}
+
+void Context::relocate_expressions(std::unordered_set<const void*> & visited) {
+    for (Context * ctx = this; ctx != NULL && visited.insert(ctx).second; ctx = ctx->m_parent_context) {
+        for (size_t i = 0; i < num_merged_state; ++i) {
+            ctx->*merged_state[i] = m.relocate(ctx->*merged_state[i]);
+        }
+        ctx->m_cpu_PC = m.relocate(ctx->m_cpu_PC);
+        ctx->m_cpu_address = m.relocate(ctx->m_cpu_address);
+        ctx->m_controller1_bits = m.relocate(ctx->m_controller1_bits);
+        for (size_t i = 0; i < ctx->m_controller1_inputs.size(); ++i) {
+            ctx->m_controller1_inputs[i] = m.relocate(ctx->m_controller1_inputs[i]);
+        }
+        m.relocate(ctx->m_feasibility_query);
+        ctx->m_path.relocate(m, visited);
+        ctx->m_cpu_ram.relocate(m, visited);
+        ctx->m_cpu_prg_ram.relocate(m, visited);
+    }
+}
+
+bool Context::is_waiting_for_solver() const {
+    return m_feasibility_query.is_valid();
+}
+
+bool Context::solver_result_ready() const {
+    return m_feasibility_query.is_ready();
+}
+
+EFeasibility Context::resolve_feasibility() {
+    ESolverStatus result = m.get_result(m_feasibility_query);
+    m_feasibility_query.reset();
+    switch (result) {
+    case SAT:
+        TRACE("cpu_branch", tout << "branch condition " << m.to_string(m_path.back()) << " is satisfiable" << std::endl;);
+        m_feasibility_unknown = false;
+        return Path_Feasible;
+    case UNSAT:
+        TRACE("cpu_branch", tout << "branch condition " << m.to_string(m_path.back()) << " is unsatisfiable" << std::endl;);
+        m_feasibility_unknown = false;
+        return Path_Infeasible;
+    case UNKNOWN:
+        TRACE("cpu_branch", tout << "solver could not decide branch condition " << m.to_string(m_path.back()) << std::endl;);
+        m_unknown_answers += 1;
+        m_feasibility_unknown = true;
+        return Path_Unknown;
+    default:
+        throw "solver error";
+    }
+}
+
+bool Context::needs_feasibility_retry() const {
+    return m_feasibility_unknown;
+}
+
+unsigned int Context::get_unknown_answers() const {
+    return m_unknown_answers;
+}
+
+// ask again, giving the solver twice the effort of the previous attempt, up to MAX_RETRY_DOUBLINGS times
+void Context::retry_feasibility() {
+    Expression condition = m_path.back();
+    TRACE("cpu_branch", tout << "retrying branch condition " << m.to_string(condition) << " (attempt " << (m_unknown_answers + 1) << ")" << std::endl;);
+    m_feasibility_unknown = false;
+    unsigned int doublings = (m_unknown_answers < MAX_RETRY_DOUBLINGS) ? m_unknown_answers : MAX_RETRY_DOUBLINGS;
+    m.check_assuming_async(m_path.get_prefix(), condition, m_feasibility_query, 1u << doublings);
+}
+
 uint64_t Context::get_cpu_cycle_count() {
     return m_cpu_cycle_count;
 }
@@ -303,30 +596,21 @@ uint64_t Context::get_cpu_cycle_count() {
 // TODO front-half read() and write() force a switch to the next peripheral
 // see MemGet() and MemSet()
 
-Expression * Context::get_cpu_last_read() {
+Expression Context::get_cpu_last_read() {
     return m_cpu_last_read;
 }
 
-void Context::cpu_read(Expression * address) {
+void Context::cpu_read(Expression address) {
     m_cpu_address = address;
     m_cpu_write_enable = false;
 }
 
-void Context::cpu_write(Expression * address, Expression * data) {
+void Context::cpu_write(Expression address, Expression data) {
     m_cpu_address = address;
     m_cpu_write_enable = true;
     m_cpu_data_out = data;
 }
 
-void Context::collect_assumptions(std::vector<Expression*> & buffer) {
-    for (std::vector<Expression*>::iterator it = m_symbolic_assumptions.begin(); it != m_symbolic_assumptions.end(); ++it) {
-        buffer.push_back(*it);
-    }
-    if (m_parent_context != NULL) {
-        m_parent_context->collect_assumptions(buffer);
-    }
-}
-
 void Context::step() {
     TRACE("step", tout << "step " << std::to_string(m_step_count) << std::endl;);
     switch (m_next_device) {
@@ -339,87 +623,83 @@ void Context::step() {
     m_step_count += 1;
 }
 
-Expression * Context::get_cpu_A() {
-    if (m_cpu_A == NULL) {
+Expression Context::get_cpu_A() {
+    if (m_cpu_A.is_null()) {
         m_cpu_A = m_parent_context->get_cpu_A();
     }
     return m_cpu_A;
 }
 
-Expression * Context::get_cpu_X() {
-    if (m_cpu_X == NULL) {
+Expression Context::get_cpu_X() {
+    if (m_cpu_X.is_null()) {
         m_cpu_X = m_parent_context->get_cpu_X();
     }
     return m_cpu_X;
 }
 
-Expression * Context::get_cpu_Y() {
-    if (m_cpu_Y == NULL) {
+Expression Context::get_cpu_Y() {
+    if (m_cpu_Y.is_null()) {
         m_cpu_Y = m_parent_context->get_cpu_Y();
     }
     return m_cpu_Y;
 }
 
-Expression * Context::get_cpu_SP() {
-    if (m_cpu_SP == NULL) {
+Expression Context::get_cpu_SP() {
+    if (m_cpu_SP.is_null()) {
         m_cpu_SP = m_parent_context->get_cpu_SP();
     }
     return m_cpu_SP;
 }
 
-Expression * Context::get_cpu_PC() {
-    if (m_cpu_PC == NULL) {
+Expression Context::get_cpu_PC() {
+    if (m_cpu_PC.is_null()) {
         m_cpu_PC = m_parent_context->get_cpu_PC();
     }
     return m_cpu_PC;
 }
 
-Expression * Context::get_cpu_FN() {
-    if (m_cpu_FN == NULL) {
+Expression Context::get_cpu_FN() {
+    if (m_cpu_FN.is_null()) {
         m_cpu_FN = m_parent_context->get_cpu_FN();
     }
     return m_cpu_FN;
 }
 
-Expression * Context::get_cpu_FV() {
-    if (m_cpu_FV == NULL) {
+Expression Context::get_cpu_FV() {
+    if (m_cpu_FV.is_null()) {
         m_cpu_FV = m_parent_context->get_cpu_FV();
     }
     return m_cpu_FV;
 }
 
-Expression * Context::get_cpu_FD() {
-    if (m_cpu_FD == NULL) {
+Expression Context::get_cpu_FD() {
+    if (m_cpu_FD.is_null()) {
         m_cpu_FD = m_parent_context->get_cpu_FD();
     }
     return m_cpu_FD;
 }
 
-Expression * Context::get_cpu_FI() {
-    if (m_cpu_FI == NULL) {
+Expression Context::get_cpu_FI() {
+    if (m_cpu_FI.is_null()) {
         m_cpu_FI = m_parent_context->get_cpu_FI();
     }
     return m_cpu_FI;
 }
 
-Expression * Context::get_cpu_FZ() {
-    if (m_cpu_FZ == NULL) {
+Expression Context::get_cpu_FZ() {
+    if (m_cpu_FZ.is_null()) {
         m_cpu_FZ = m_parent_context->get_cpu_FZ();
     }
     return m_cpu_FZ;
 }
 
-Expression * Context::get_cpu_FC() {
-    if (m_cpu_FC == NULL) {
+Expression Context::get_cpu_FC() {
+    if (m_cpu_FC.is_null()) {
         m_cpu_FC = m_parent_context->get_cpu_FC();
     }
     return m_cpu_FC;
 }
 
-Expression ** Context::get_cpu_RAM() {
-    return m_cpu_ram;
-}
-
 bool * Context::get_cpu_readable() {
     return m_cpu_readable;
 }
@@ -428,18 +708,22 @@ bool * Context::get_cpu_writable() {
     return m_cpu_writable;
 }
 
-Expression *** Context::get_cpu_PRG_pointer() {
+const uint8_t ** Context::get_cpu_PRG_pointer() {
     return m_cpu_prg_pointer;
 }
 
-Expression * Context::get_cpu_address() {
-    if (m_cpu_address == NULL) {
+uint8_t * Context::get_cpu_PRG_RAM_bank() {
+    return m_cpu_prg_ram_bank;
+}
+
+Expression Context::get_cpu_address() {
+    if (m_cpu_address.is_null()) {
         m_cpu_address = m_parent_context->get_cpu_address();
     }
     return m_cpu_address;
 }
 
-Expression *** Context::get_cpu_PRG_ROM() {
+const uint8_t * Context::get_cpu_PRG_ROM() {
     if (m_parent_context != NULL) {
         m_PRG_ROM = m_parent_context->get_cpu_PRG_ROM();
     }
@@ -462,6 +746,22 @@ uint32_t Context::get_prg_mask_rom() {
     return mask & (MAX_PRG_ROM_SIZE - 1);
 }
 
+uint32_t Context::get_prg_size_rom() {
+    return m_mapper_prg_size_rom;
+}
+
+PagedRAM & Context::get_cpu_PRG_RAM() {
+    // most cartridges have none, so contexts don't pay for it until a bank is mapped
+    if (m_cpu_prg_ram.get_size() == 0) {
+        m_cpu_prg_ram = PagedRAM(m_mapper_prg_size_ram * 0x1000, DIGEST_PRG_RAM);
+    }
+    return m_cpu_prg_ram;
+}
+
+uint32_t Context::get_prg_size_ram() {
+    return m_mapper_prg_size_ram;
+}
+
 void Context::cpu_reset() {
     TRACE("cpu", tout << "In reset sequence..." << std::endl;);
     switch (m_cpu_state) {
@@ -593,17 +893,17 @@ void Context::increment_PC() {
 }
 
 // sets FC = (test >= 0)
-void Context::cpu_set_FC(Expression * test) {
+void Context::cpu_set_FC(Expression test) {
     m_cpu_FC = m.mk_bv_signed_greater_than_or_equal(test, m.mk_byte(0));
 }
 
 // sets FN = (test >> 7) == 0x01
-void Context::cpu_set_FN(Expression * test) {
+void Context::cpu_set_FN(Expression test) {
     m_cpu_FN = m.mk_eq(m.mk_bv_logical_right_shift(test, m.mk_byte(7)), m.mk_byte(1));
 }
 
 // sets FZ = (test == 0)
-void Context::cpu_set_FZ(Expression * test) {
+void Context::cpu_set_FZ(Expression test) {
     m_cpu_FZ = m.mk_eq(test, m.mk_byte(0));
 }
 
@@ -697,9 +997,9 @@ void Context::cpu_addressing_mode_cycle() {
             break;
         case 2:
         {
-            Expression * CalcAddrL = m.mk_bv_extract(m_cpu_calc_addr, m.mk_int(7), m.mk_int(0));
-            if (CalcAddrL->is_concrete() && get_cpu_X()->is_concrete()) {
-                uint32_t val = CalcAddrL->get_value() + get_cpu_X()->get_value();
+            Expression CalcAddrL = m.mk_bv_extract(m_cpu_calc_addr, m.mk_int(7), m.mk_int(0));
+            if (CalcAddrL.is_concrete() && get_cpu_X().is_concrete()) {
+                uint32_t val = CalcAddrL.get_value() + get_cpu_X().get_value();
                 // set CalcAddr = [LastRead | CalcAddrL + X]
                 m_cpu_calc_addr = m.mk_bv_concat(m_cpu_last_read, m.mk_bv_add(CalcAddrL, get_cpu_X()));
                 if (val >= 0x100) {
@@ -718,8 +1018,8 @@ void Context::cpu_addressing_mode_cycle() {
         {
             // this is the extra cycle
             // throw away the read value, increment CalcAddrH, and we're done
-            Expression * CalcAddrH = m.mk_bv_extract(m_cpu_calc_addr, m.mk_int(15), m.mk_int(8));
-            Expression * CalcAddrL = m.mk_bv_extract(m_cpu_calc_addr, m.mk_int(7), m.mk_int(0));
+            Expression CalcAddrH = m.mk_bv_extract(m_cpu_calc_addr, m.mk_int(15), m.mk_int(8));
+            Expression CalcAddrL = m.mk_bv_extract(m_cpu_calc_addr, m.mk_int(7), m.mk_int(0));
             m_cpu_calc_addr = m.mk_bv_concat(m.mk_bv_add(CalcAddrH, m.mk_byte(0x01)), CalcAddrL);
             // finally done
             m_cpu_state = CPU_Execute;
@@ -736,7 +1036,7 @@ void Context::cpu_addressing_mode_cycle() {
 
 void Context::cpu_branch(ECPUStatusFlag testedFlag, bool polarity) {
     // construct condition
-    Expression * condition;
+    Expression condition;
     switch (testedFlag) {
     case CPU_FC:
         condition = get_cpu_FC();
@@ -758,8 +1058,8 @@ void Context::cpu_branch(ECPUStatusFlag testedFlag, bool polarity) {
         condition = m.mk_not(condition);
     }
 
-    if (condition->is_concrete()) {
-        if (condition->get_value() != 0) {
+    if (condition.is_concrete()) {
+        if (condition.get_value() != 0) {
             switch (m_cpu_execute_cycle) {
             case 0:
                 // TODO special interrupt ignoring "bug"
@@ -789,15 +1089,15 @@ void Context::cpu_branch(ECPUStatusFlag testedFlag, bool polarity) {
                         }
                 }
         `       */
-                if (m_cpu_branch_offset->is_concrete()) {
-                    uint32_t val = ( get_cpu_PC()->get_value() & 0x00FF ) + m_cpu_branch_offset->get_value();
+                if (m_cpu_branch_offset.is_concrete()) {
+                    uint32_t val = ( get_cpu_PC().get_value() & 0x00FF ) + m_cpu_branch_offset.get_value();
                     bool inc = (val >= 0x100);
                     // PC[7:0] = PC[7:0] + BranchOffset
-                    Expression * PCH = m.mk_bv_extract(get_cpu_PC(), m.mk_int(15), m.mk_int(8));
-                    Expression * PCL = m.mk_bv_extract(get_cpu_PC(), m.mk_int(7), m.mk_int(0));
+                    Expression PCH = m.mk_bv_extract(get_cpu_PC(), m.mk_int(15), m.mk_int(8));
+                    Expression PCL = m.mk_bv_extract(get_cpu_PC(), m.mk_int(7), m.mk_int(0));
                     m_cpu_PC = m.mk_bv_concat(PCH, m.mk_bv_add(PCL, m_cpu_branch_offset));
                     // decide whether an extra cycle is needed due to page crossing
-                    if (m_cpu_branch_offset->get_value() & 0x80) {
+                    if (m_cpu_branch_offset.get_value() & 0x80) {
                         if (!inc) {
                             // extra cycle
                             cpu_read(m_cpu_PC);
@@ -823,9 +1123,9 @@ void Context::cpu_branch(ECPUStatusFlag testedFlag, bool polarity) {
             {
                 // we can assume m_cpu_branch_offset is concrete
                 // all we have to do is adjust PCH in the appropriate direction
-                Expression * PCH = m.mk_bv_extract(get_cpu_PC(), m.mk_int(15), m.mk_int(8));
-                Expression * PCL = m.mk_bv_extract(get_cpu_PC(), m.mk_int(7), m.mk_int(0));
-                if (m_cpu_branch_offset->get_value() & 0x80) {
+                Expression PCH = m.mk_bv_extract(get_cpu_PC(), m.mk_int(15), m.mk_int(8));
+                Expression PCL = m.mk_bv_extract(get_cpu_PC(), m.mk_int(7), m.mk_int(0));
+                if (m_cpu_branch_offset.get_value() & 0x80) {
                     // PCH --
                     m_cpu_PC = m.mk_bv_concat(m.mk_bv_sub(PCH, m.mk_byte(1)), PCL);
                 } else {
@@ -838,96 +1138,55 @@ void Context::cpu_branch(ECPUStatusFlag testedFlag, bool polarity) {
             }
         } else {
             TRACE("cpu_branch", tout << "branch not taken" << std::endl;);
+            // the operand fetch was the last cycle of the instruction
+            instruction_fetch();
         }
     } else {
-        TRACE("cpu", tout << "symbolic branch: " << condition->to_string() << std::endl;);
-        std::vector<Expression*> assumptions;
-        collect_assumptions(assumptions);
-        bool branch_condition_can_be_true = false;
-        bool branch_condition_can_be_false = false;
-
-        // check positive condition
-        TRACE("cpu_branch", tout << "checking whether branch condition can be true" << std::endl;);
-        std::vector<Expression*> branch_taken_assertions(assumptions);
-        branch_taken_assertions.push_back(condition);
-        ESolverStatus branch_taken_result = m.call_solver(branch_taken_assertions, NULL);
-        switch (branch_taken_result) {
-        case SAT:
-            TRACE("cpu_branch", tout << "branch condition is satisfiable" << std::endl;);
-            branch_condition_can_be_true = true;
+        TRACE("cpu", tout << "symbolic branch: " << m.to_string(condition) << std::endl;);
+
+        // Both directions are checked at once. Each continuation is created now, while the CPU
+        // is at this point of the step, and waits in the scheduler until the solver has decided
+        // whether it is feasible; meanwhile, other contexts keep running.
+        Context * branch_taken_context = new Context(get_manager(), this);
+        branch_taken_context->m_path = m.extend_path(m_path, condition);
+        switch (testedFlag) {
+        case CPU_FC:
+            branch_taken_context->m_cpu_FC = m.mk_bool(polarity);
+            break;
+        case CPU_FN:
+            branch_taken_context->m_cpu_FN = m.mk_bool(polarity);
             break;
-        case UNSAT:
-            TRACE("cpu_branch", tout << "branch condition is unsatisfiable" << std::endl;);
+        case CPU_FV:
+            branch_taken_context->m_cpu_FV = m.mk_bool(polarity);
             break;
-        default:
-            throw "solver error";
+        case CPU_FZ:
+            branch_taken_context->m_cpu_FZ = m.mk_bool(polarity);
             break;
         }
-        // check negative condition
-        TRACE("cpu_branch", tout << "checking whether negated branch condition can be true" << std::endl;);
-        std::vector<Expression*> branch_not_taken_assertions(assumptions);
-        branch_not_taken_assertions.push_back(m.mk_not(condition));
-        ESolverStatus branch_not_taken_result = m.call_solver(branch_not_taken_assertions, NULL);
-        switch (branch_not_taken_result) {
-        case SAT:
-            TRACE("cpu_branch", tout << "negated branch condition is satisfiable" << std::endl;);
-            branch_condition_can_be_false = true;
+        TRACE("cpu_branch", tout << "checking whether branch condition can be true" << std::endl;);
+        m.check_assuming_async(m_path, condition, branch_taken_context->m_feasibility_query);
+
+        Context * branch_not_taken_context = new Context(get_manager(), this);
+        branch_not_taken_context->m_path = m.extend_path(m_path, m.mk_not(condition));
+        switch (testedFlag) {
+        case CPU_FC:
+            branch_not_taken_context->m_cpu_FC = m.mk_bool(!polarity);
             break;
-        case UNSAT:
-            TRACE("cpu_branch", tout << "negated branch condition is unsatisfiable" << std::endl;);
+        case CPU_FN:
+            branch_not_taken_context->m_cpu_FN = m.mk_bool(!polarity);
             break;
-        default:
-            throw "solver error";
+        case CPU_FV:
+            branch_not_taken_context->m_cpu_FV = m.mk_bool(!polarity);
+            break;
+        case CPU_FZ:
+            branch_not_taken_context->m_cpu_FZ = m.mk_bool(!polarity);
             break;
         }
+        TRACE("cpu_branch", tout << "checking whether negated branch condition can be true" << std::endl;);
+        m.check_assuming_async(m_path, branch_not_taken_context->m_path.back(), branch_not_taken_context->m_feasibility_query);
 
-        if (!branch_condition_can_be_true && !branch_condition_can_be_false) {
-            // TODO mark this context as terminated instead
-            TRACE("cpu_branch", tout << "terminating context -- impossible to take either path of this branch" << std::endl;);
-            m_has_forked = true;
-            return;
-        }
-
-        // one or the other branch is possible
-        if (branch_condition_can_be_true) {
-            Context * branch_taken_context = new Context(get_manager(), this);
-            branch_taken_context->m_symbolic_assumptions.push_back(condition);
-            switch (testedFlag) {
-            case CPU_FC:
-                branch_taken_context->m_cpu_FC = m.mk_bool(polarity);
-                break;
-            case CPU_FN:
-                branch_taken_context->m_cpu_FN = m.mk_bool(polarity);
-                break;
-            case CPU_FV:
-                branch_taken_context->m_cpu_FV = m.mk_bool(polarity);
-                break;
-            case CPU_FZ:
-                branch_taken_context->m_cpu_FZ = m.mk_bool(polarity);
-                break;
-            }
-            get_scheduler().add_context(branch_taken_context);
-        }
-
-        if (branch_condition_can_be_false) {
-            Context * branch_not_taken_context = new Context(get_manager(), this);
-            branch_not_taken_context->m_symbolic_assumptions.push_back(m.mk_not(condition));
-            switch (testedFlag) {
-            case CPU_FC:
-                branch_not_taken_context->m_cpu_FC = m.mk_bool(!polarity);
-                break;
-            case CPU_FN:
-                branch_not_taken_context->m_cpu_FN = m.mk_bool(!polarity);
-                break;
-            case CPU_FV:
-                branch_not_taken_context->m_cpu_FV = m.mk_bool(!polarity);
-                break;
-            case CPU_FZ:
-                branch_not_taken_context->m_cpu_FZ = m.mk_bool(!polarity);
-                break;
-            }
-            get_scheduler().add_context(branch_not_taken_context);
-        }
+        get_scheduler().add_context(branch_taken_context);
+        get_scheduler().add_context(branch_not_taken_context);
         m_has_forked = true;
     }
 }
@@ -1022,7 +1281,7 @@ void Context::cpu_execute() {
             cpu_read(m_cpu_calc_addr);
             break;
         case 1:
-            Expression * result = m.mk_bv_sub(get_cpu_A(), m_cpu_last_read);
+            Expression result = m.mk_bv_sub(get_cpu_A(), m_cpu_last_read);
             cpu_set_FC(result);
             cpu_set_FN(result);
             cpu_set_FZ(result);
@@ -1043,7 +1302,7 @@ void Context::cpu_execute() {
             cpu_read(m_cpu_calc_addr);
             break;
         case 1:
-            Expression * result = m.mk_bv_sub(get_cpu_X(), m_cpu_last_read);
+            Expression result = m.mk_bv_sub(get_cpu_X(), m_cpu_last_read);
             cpu_set_FC(result);
             cpu_set_FN(result);
             cpu_set_FZ(result);
@@ -1064,7 +1323,7 @@ void Context::cpu_execute() {
             cpu_read(m_cpu_calc_addr);
             break;
         case 1:
-            Expression * result = m.mk_bv_sub(get_cpu_Y(), m_cpu_last_read);
+            Expression result = m.mk_bv_sub(get_cpu_Y(), m_cpu_last_read);
             cpu_set_FC(result);
             cpu_set_FN(result);
             cpu_set_FZ(result);
@@ -1320,8 +1579,8 @@ void Context::step_cpu() {
 
     if (m_cpu_memory_phase) {
         // deal with the address right away
-        if (get_cpu_address()->is_concrete()) {
-            address = (uint16_t) (get_cpu_address()->get_value() & 0x0000FFFF);
+        if (get_cpu_address().is_concrete()) {
+            address = (uint16_t) (get_cpu_address().get_value() & 0x0000FFFF);
             TRACE("cpu_memory", tout << "access memory at " << std::to_string(address) << std::endl;);
         } else {
             // oh no. symbolic address.
@@ -1334,8 +1593,8 @@ void Context::step_cpu() {
             m_cpu_write_handler[(address >> 12) & 0xF](*this, (address >> 12) & 0xF, (address & 0xFFF), m_cpu_data_out);
         } else {
             // complete read by setting data_in
-            Expression * buf = m_cpu_read_handler[(address >> 12) & 0xF](*this, (address >> 12) & 0xF, (address & 0xFFF) );
-            if (buf == NULL) {
+            Expression buf = m_cpu_read_handler[(address >> 12) & 0xF](*this, (address >> 12) & 0xF, (address & 0xFFF) );
+            if (buf.is_null()) {
                 // bogus read, give all ones
                 // data_in = m.mk_byte(0xFF);
                 m_cpu_last_read = m.mk_byte(0xFF);
@@ -1343,7 +1602,7 @@ void Context::step_cpu() {
             } else {
                 // data_in = buf;
                 m_cpu_last_read = buf;
-                CTRACE("cpu_memory", m_cpu_last_read->is_concrete(), tout << "read value " << m_cpu_last_read->get_value() << std::endl;);
+                CTRACE("cpu_memory", m_cpu_last_read.is_concrete(), tout << "read value " << m_cpu_last_read.get_value() << std::endl;);
             }
         }
         m_cpu_memory_phase = false;
@@ -1365,10 +1624,10 @@ void Context::step_cpu() {
         cpu_reset(); break;
     case CPU_Decode:
         // check the opcode we just read
-        if (m_cpu_last_read->is_concrete()) {
+        if (m_cpu_last_read.is_concrete()) {
             // do this increment here so that we don't increment it twice if we fork
             increment_PC();
-            m_cpu_current_opcode = (uint8_t)(m_cpu_last_read->get_value() & 0xFF);
+            m_cpu_current_opcode = (uint8_t)(m_cpu_last_read.get_value() & 0xFF);
             TRACE("cpu", tout << "opcode = " << std::to_string(m_cpu_current_opcode) << std::endl;);
             m_cpu_addressing_mode_cycle = 0;
             m_cpu_execute_cycle = 0;
@@ -1404,17 +1663,17 @@ void Context::step_cpu() {
         throw "oops, unhandled state";
     }
 
-#define PRINT_FLAG(flag, name_set, name_unset) { Expression * tmp = flag; \
-    if (tmp->is_concrete()) {if (tmp->get_value() == 1) tout << name_set << " " ; else tout << name_unset << " ";} \
+#define PRINT_FLAG(flag, name_set, name_unset) { Expression tmp = flag; \
+    if (tmp.is_concrete()) {if (tmp.get_value() == 1) tout << name_set << " " ; else tout << name_unset << " ";} \
     else {tout << name_set << "?";} }
 
     TRACE("cpu",
         tout << "registers at end of step:" << std::endl;
-        tout << "A = " << get_cpu_A()->to_string() << std::endl;
-        tout << "X = " << get_cpu_X()->to_string() << std::endl;
-        tout << "Y = " << get_cpu_Y()->to_string() << std::endl;
-        tout << "SP = " << get_cpu_SP()->to_string() << std::endl;
-        tout << "PC = " << get_cpu_PC()->to_string() << std::endl;
+        tout << "A = " << m.to_string(get_cpu_A()) << std::endl;
+        tout << "X = " << m.to_string(get_cpu_X()) << std::endl;
+        tout << "Y = " << m.to_string(get_cpu_Y()) << std::endl;
+        tout << "SP = " << m.to_string(get_cpu_SP()) << std::endl;
+        tout << "PC = " << m.to_string(get_cpu_PC()) << std::endl;
         // P: N V . . D I Z C
         tout << "P = ";
         PRINT_FLAG(get_cpu_FN(), "N", "n");
@@ -1431,16 +1690,16 @@ void Context::step_cpu() {
     m_cpu_cycle_count += 1;
 }
 
-std::vector<Expression*> & Context::get_controller1_inputs() {
+std::vector<Expression> & Context::get_controller1_inputs() {
     return m_controller1_inputs;
 }
 
 // TODO regenerating controller_bits causes extra vars to be generated -- try to eliminate these if they aren't used
 
-void Context::controller_write(Expression * val) {
+void Context::controller_write(Expression val) {
     TRACE("controller", tout << "write controllers" << std::endl;);
-    if (val->is_concrete()) {
-        bool strobe = val->get_value() & 1;
+    if (val.is_concrete()) {
+        bool strobe = val.get_value() & 1;
         if (m_controller1_strobe || strobe) {
             m_controller1_strobe = strobe;
             m_controller1_bits = controller_mk_var(1);
@@ -1453,9 +1712,9 @@ void Context::controller_write(Expression * val) {
 
 // TODO allow playback of concrete controller inputs (this requires knowing when frames happen)
 
-Expression * Context::controller_read1() {
+Expression Context::controller_read1() {
     TRACE("controller", tout << "read controller 1" << std::endl;);
-    Expression * result;
+    Expression result;
     if (m_controller1_strobe) {
         m_controller1_bits = controller_mk_var(1);
         m_controller1_bit_ptr = 0;
@@ -1472,12 +1731,12 @@ Expression * Context::controller_read1() {
     return result;
 }
 
-Expression * Context::controller_read2() {
+Expression Context::controller_read2() {
     // TODO
-    return NULL;
+    return Expression();
 }
 
-Expression * Context::controller_mk_var(int controller_number) {
+Expression Context::controller_mk_var(int controller_number) {
     std::string var_name = "controller" + std::to_string(controller_number) + "_frame" + std::to_string(m_frame_number);
     if (controller_number == 1) {
         var_name += "_" + std::to_string(m_controller1_seqno);
@@ -1485,7 +1744,7 @@ Expression * Context::controller_mk_var(int controller_number) {
     } else if (controller_number == 2) {
         // TODO seqno 2
     }
-    Expression * var = m.mk_var(var_name, 8);
+    Expression var = m.mk_var(var_name, 8);
     m_controller1_inputs.push_back(var);
     return var;
 }
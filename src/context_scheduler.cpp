@@ -12,40 +12,214 @@ bool context_priority_cmp::operator ()(const Context* lhs, const Context* rhs) {
     return lhs_priority < rhs_priority;
 }
 
-ContextScheduler::ContextScheduler() : m_maximum_cpu_cycles(0) {}
+ContextScheduler::ContextScheduler()
+: m_deduplicate_states(true), m_maximum_cpu_cycles(0), m_maximum_solver_retries(3), m_merge_limit(16),
+  m_collection_threshold(1 << 20), m_next_collection(1 << 20) {}
 
 ContextScheduler::~ContextScheduler() {
-    // TODO delete contexts in the run queue and in the list of completed contexts
+    // drop the references on the contexts that are still live
+    while (!m_run_queue.empty()) {
+        m_run_queue.top()->release();
+        m_run_queue.pop();
+    }
+    for (std::vector<Context*>::iterator it = m_waiting_contexts.begin(); it != m_waiting_contexts.end(); ++it) {
+        (*it)->release();
+    }
+    m_waiting_contexts.clear();
+    for (std::multimap<uint64_t, Context*>::iterator it = m_parked_contexts.begin(); it != m_parked_contexts.end(); ++it) {
+        it->second->release();
+    }
+    m_parked_contexts.clear();
 }
 
 void ContextScheduler::set_maximum_cpu_cycles(uint64_t max_cycles) {
     m_maximum_cpu_cycles = max_cycles;
 }
 
+void ContextScheduler::set_maximum_solver_retries(unsigned int max_retries) {
+    m_maximum_solver_retries = max_retries;
+}
+
+void ContextScheduler::set_merge_limit(unsigned int limit) {
+    m_merge_limit = limit;
+}
+
+void ContextScheduler::set_state_deduplication(bool enabled) {
+    m_deduplicate_states = enabled;
+}
+
+void ContextScheduler::set_collection_threshold(uint32_t num_nodes) {
+    m_collection_threshold = num_nodes;
+    m_next_collection = num_nodes;
+}
+
 void ContextScheduler::add_context(Context * ctx) {
-    m_run_queue.push(ctx);
+    if (ctx->is_waiting_for_solver()) {
+        m_waiting_contexts.push_back(ctx);
+    } else {
+        m_run_queue.push(ctx);
+    }
 }
 
 bool ContextScheduler::have_contexts() {
-    return !m_run_queue.empty();
+    return !m_run_queue.empty() || !m_waiting_contexts.empty() || !m_parked_contexts.empty();
+}
+
+void ContextScheduler::admit_waiting_contexts(bool block) {
+    size_t i = 0;
+    while (i < m_waiting_contexts.size()) {
+        Context * ctx = m_waiting_contexts[i];
+        if (!ctx->solver_result_ready() && !(block && m_run_queue.empty())) {
+            ++i;
+            continue;
+        }
+        m_waiting_contexts.erase(m_waiting_contexts.begin() + i);
+        EFeasibility feasibility;
+        try {
+            feasibility = ctx->resolve_feasibility();
+        } catch (...) {
+            ctx->release();
+            throw;
+        }
+        if (feasibility == Path_Feasible) {
+            m_run_queue.push(ctx);
+        } else if (feasibility == Path_Infeasible) {
+            TRACE("scheduler", tout << "discarding infeasible context" << std::endl;);
+            ctx->release();
+        } else if (ctx->get_unknown_answers() > m_maximum_solver_retries) {
+            TRACE("scheduler", tout << "abandoning context after " << ctx->get_unknown_answers() << " unknown answers" << std::endl;);
+            ctx->release();
+        } else {
+            m_run_queue.push(ctx);
+        }
+    }
+}
+
+bool ContextScheduler::reach_join_point(Context * ctx) {
+    uint64_t cycle = ctx->get_cpu_cycle_count();
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        std::pair<std::multimap<uint64_t, Context*>::iterator, std::multimap<uint64_t, Context*>::iterator> parked
+            = m_parked_contexts.equal_range(cycle);
+        for (std::multimap<uint64_t, Context*>::iterator it = parked.first; it != parked.second; ++it) {
+            Context * other = it->second;
+            if (!ctx->can_merge_with(*other)) {
+                continue;
+            }
+            unsigned int cost = ctx->get_merge_cost(*other, m_merge_limit);
+            if (cost > m_merge_limit) {
+                TRACE("scheduler", tout << "not merging contexts at cycle " << cycle << ": cost exceeds " << m_merge_limit << std::endl;);
+                continue;
+            }
+            TRACE("scheduler", tout << "merging contexts at cycle " << cycle << " (cost " << cost << ")" << std::endl;);
+            ctx->merge(*other);
+            m_parked_contexts.erase(it);
+            other->release();
+            merged = true;
+            break;
+        }
+    }
+    // let the contexts that may be behind catch up, so that they can merge with this one
+    if (!m_run_queue.empty() || !m_waiting_contexts.empty()
+        || (!m_parked_contexts.empty() && m_parked_contexts.begin()->first < cycle)) {
+        m_parked_contexts.insert(std::make_pair(cycle, ctx));
+        return true;
+    }
+    return false;
+}
+
+bool ContextScheduler::visit_state(Context * ctx) {
+    StateDigest digest = ctx->get_state_digest();
+    digest.toggle(DIGEST_PATH, 0, ctx->get_state_path_hash());
+    return m_visited_states.insert(digest).second;
+}
+
+void ContextScheduler::collect_garbage(Context * ctx) {
+    ASTManager & m = ctx->get_manager();
+    TRACE("scheduler", tout << "collecting expression nodes (" << m.get_num_nodes() << " in use)" << std::endl;);
+    // the run queue cannot be walked, so it is emptied and filled again afterwards
+    std::vector<Context*> runnable;
+    while (!m_run_queue.empty()) {
+        runnable.push_back(m_run_queue.top());
+        m_run_queue.pop();
+    }
+    std::vector<Context*> contexts(runnable);
+    contexts.push_back(ctx);
+    contexts.insert(contexts.end(), m_waiting_contexts.begin(), m_waiting_contexts.end());
+    for (std::multimap<uint64_t, Context*>::iterator it = m_parked_contexts.begin(); it != m_parked_contexts.end(); ++it) {
+        contexts.push_back(it->second);
+    }
+
+    m.begin_collection();
+    std::unordered_set<const void*> visited;
+    for (std::vector<Context*>::iterator it = contexts.begin(); it != contexts.end(); ++it) {
+        (*it)->mark_live(visited);
+    }
+    m.collect_garbage();
+    visited.clear();
+    for (std::vector<Context*>::iterator it = contexts.begin(); it != contexts.end(); ++it) {
+        (*it)->relocate_expressions(visited);
+    }
+    for (std::vector<Context*>::iterator it = runnable.begin(); it != runnable.end(); ++it) {
+        m_run_queue.push(*it);
+    }
+    // the state digests cover node indices, which have changed
+    m_visited_states.clear();
+
+    uint32_t kept = m.get_num_nodes();
+    m_next_collection = (kept > m_collection_threshold / 2) ? kept * 2 : m_collection_threshold;
 }
 
 void ContextScheduler::run_next_context() {
-    Context * ctx = m_run_queue.top();
-    m_run_queue.pop();
+    // parked contexts can run while the solver is busy
+    admit_waiting_contexts(m_parked_contexts.empty());
+    Context * ctx;
+    if (!m_run_queue.empty()) {
+        ctx = m_run_queue.top();
+        m_run_queue.pop();
+    } else if (!m_parked_contexts.empty()) {
+        // the context furthest behind
+        ctx = m_parked_contexts.begin()->second;
+        m_parked_contexts.erase(m_parked_contexts.begin());
+    } else {
+        return;
+    }
+    if (m_collection_threshold != 0 && ctx->get_manager().get_num_nodes() >= m_next_collection) {
+        collect_garbage(ctx);
+    }
+    if (ctx->needs_feasibility_retry()) {
+        ctx->retry_feasibility();
+        m_waiting_contexts.push_back(ctx);
+        return;
+    }
+    if (m_deduplicate_states && !visit_state(ctx)) {
+        TRACE("scheduler", tout << "dropping context in a state that has been visited before" << std::endl;);
+        ctx->release();
+        return;
+    }
 
     while (true) {
-        ctx->step();
+        try {
+            ctx->step();
+        } catch (...) {
+            ctx->release();
+            throw;
+        }
         // check for context forks
         if (ctx->has_forked()) {
             TRACE("scheduler", tout << "Context has forked" << std::endl;);
-            m_completed_contexts.push_back(ctx);
+            // its children hold it for as long as they need it
+            ctx->release();
             break;
         }
         // check for per-cycle stopping conditions
         if (m_maximum_cpu_cycles != 0 && ctx->get_cpu_cycle_count() >= m_maximum_cpu_cycles) {
             TRACE("scheduler", tout << "Stopping because maximum CPU cycle count was exceeded" << std::endl;);
-            m_completed_contexts.push_back(ctx);
+            ctx->release();
+            break;
+        }
+        if (m_merge_limit != 0 && ctx->is_at_instruction_boundary() && reach_join_point(ctx)) {
             break;
         }
         // TODO check for other per-cycle stopping conditions
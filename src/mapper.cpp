@@ -11,7 +11,9 @@ void Mapper::cpu_cycle(Context & ctx){}
 void Mapper::ppu_cycle(Context & ctx){}
 
 void Mapper::set_PRG_ROM_4(Context & ctx, int bank, int val) {
-    ctx.get_cpu_PRG_pointer()[bank] =  ctx.get_cpu_PRG_ROM()[val & ctx.get_prg_mask_rom()];
+    // a ROM whose size is not a power of two mirrors its banks
+    uint32_t rom_bank = (val & ctx.get_prg_mask_rom()) % ctx.get_prg_size_rom();
+    ctx.get_cpu_PRG_pointer()[bank] = ctx.get_cpu_PRG_ROM() + rom_bank * 0x1000;
     ctx.get_cpu_readable()[bank] = true;
     ctx.get_cpu_writable()[bank] = false;
 }
@@ -42,6 +44,24 @@ void Mapper::set_PRG_ROM_32(Context & ctx, int bank, int val) {
     set_PRG_ROM_4(ctx, bank+7, val+7);
 }
 
+void Mapper::set_PRG_RAM_4(Context & ctx, int bank, int val) {
+    if (ctx.get_prg_size_ram() == 0) {
+        throw "cartridge has no PRG RAM";
+    }
+    // allocates the RAM if this is the first bank of it to be mapped
+    ctx.get_cpu_PRG_RAM();
+    ctx.get_cpu_PRG_pointer()[bank] = NULL;
+    ctx.get_cpu_PRG_RAM_bank()[bank] = val % ctx.get_prg_size_ram();
+    ctx.get_cpu_readable()[bank] = true;
+    ctx.get_cpu_writable()[bank] = true;
+}
+
+void Mapper::set_PRG_RAM_8(Context & ctx, int bank, int val) {
+    val <<= 1;
+    set_PRG_RAM_4(ctx, bank+0, val+0);
+    set_PRG_RAM_4(ctx, bank+1, val+1);
+}
+
 Mapper * get_mapper(unsigned int mapper_id, uint8_t ines_flags) {
     switch (mapper_id) {
     case 0:
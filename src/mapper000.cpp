@@ -15,18 +15,18 @@ void Mapper000::reset(Context & ctx) {
     // TODO iNES_SetMirroring()
 
     set_PRG_ROM_32(ctx, 0x8, 0);
+    // battery-backed RAM at $6000-$7FFF
+    if (m_ines_flags & 0x02) {
+        set_PRG_RAM_8(ctx, 0x6, 0);
+    }
 
     // TODO CHR ROM
-    // TODO PRG RAM
     /*
      * if (ROM->INES_CHRSize) {
      *   EMU->SetCHR_ROM8(0, 0)
      * } else {
      *   EMU->SetCHR_RAM8(0, 0)
      * }
-     * if (ROM->INES_Flags & 0x02) {
-     *   EMU->SetPRG_RAM8(0x6, 0)
-     * }
      */
 
 }
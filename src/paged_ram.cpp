@@ -0,0 +1,177 @@
+#include "paged_ram.h"
+#include "ast_manager.h"
+#include <cstring>
+
+PagedRAM::PagedRAM(uint32_t size, EDigestDomain domain)
+: m_num_pages(size / PAGE_BYTES), m_pages(new Page*[size / PAGE_BYTES]), m_domain(domain) {
+    if (m_num_pages == 0) {
+        return;
+    }
+    // all pages start out as one shared zero page
+    Page * zero = new Page;
+    zero->references = m_num_pages;
+    memset(zero->bytes, 0, sizeof(zero->bytes));
+    memset(zero->symbolic, 0, sizeof(zero->symbolic));
+    for (uint32_t i = 0; i < m_num_pages; ++i) {
+        m_pages[i] = zero;
+    }
+}
+
+PagedRAM::PagedRAM(const PagedRAM & other) : m_num_pages(other.m_num_pages), m_pages(new Page*[other.m_num_pages]),
+  m_domain(other.m_domain), m_digest(other.m_digest) {
+    for (uint32_t i = 0; i < m_num_pages; ++i) {
+        m_pages[i] = other.m_pages[i];
+        m_pages[i]->references += 1;
+    }
+}
+
+PagedRAM & PagedRAM::operator=(const PagedRAM & other) {
+    if (this == &other) {
+        return *this;
+    }
+    for (uint32_t i = 0; i < other.m_num_pages; ++i) {
+        other.m_pages[i]->references += 1;
+    }
+    for (uint32_t i = 0; i < m_num_pages; ++i) {
+        release(m_pages[i]);
+    }
+    if (m_num_pages != other.m_num_pages) {
+        delete[] m_pages;
+        m_num_pages = other.m_num_pages;
+        m_pages = new Page*[m_num_pages];
+    }
+    for (uint32_t i = 0; i < m_num_pages; ++i) {
+        m_pages[i] = other.m_pages[i];
+    }
+    m_domain = other.m_domain;
+    m_digest = other.m_digest;
+    return *this;
+}
+
+PagedRAM::~PagedRAM() {
+    for (uint32_t i = 0; i < m_num_pages; ++i) {
+        release(m_pages[i]);
+    }
+    delete[] m_pages;
+}
+
+void PagedRAM::release(Page * page) {
+    page->references -= 1;
+    if (page->references == 0) {
+        delete page;
+    }
+}
+
+Expression PagedRAM::read(uint16_t addr) const {
+    const Page * page = m_pages[addr / PAGE_BYTES];
+    uint8_t offset = addr % PAGE_BYTES;
+    if ((page->symbolic[offset >> 6] >> (offset & 63)) & 1) {
+        return page->symbolic_values.find(offset)->second;
+    }
+    return Expression::mk_bv(page->bytes[offset], 8);
+}
+
+void PagedRAM::toggle_cell(StateDigest & digest, uint16_t addr, Expression value) const {
+    if (value.is_concrete() && value.get_value() == 0) {
+        // so that zeroed memory has an empty digest
+        return;
+    }
+    digest.toggle(m_domain, (uint64_t)addr | ((uint64_t)value.get_kind() << 16) | ((uint64_t)value.get_width() << 24), value.get_value());
+}
+
+PagedRAM::Page * PagedRAM::get_writable_page(uint16_t addr) {
+    Page *& page = m_pages[addr / PAGE_BYTES];
+    if (page->references > 1) {
+        Page * copy = new Page(*page);
+        copy->references = 1;
+        page->references -= 1;
+        page = copy;
+    }
+    return page;
+}
+
+void PagedRAM::write(uint16_t addr, Expression value) {
+    uint8_t offset = addr % PAGE_BYTES;
+    uint64_t bit = (uint64_t)1 << (offset & 63);
+    // writing what the cell already holds must not unshare its page
+    const Page * current = m_pages[addr / PAGE_BYTES];
+    if (value.is_concrete()) {
+        if (!(current->symbolic[offset >> 6] & bit) && current->bytes[offset] == (uint8_t)value.get_value()) {
+            return;
+        }
+        toggle_cell(m_digest, addr, read(addr));
+        toggle_cell(m_digest, addr, value);
+        Page * page = get_writable_page(addr);
+        page->bytes[offset] = (uint8_t)value.get_value();
+        if (page->symbolic[offset >> 6] & bit) {
+            page->symbolic[offset >> 6] &= ~bit;
+            page->symbolic_values.erase(offset);
+        }
+    } else {
+        toggle_cell(m_digest, addr, read(addr));
+        toggle_cell(m_digest, addr, value);
+        Page * page = get_writable_page(addr);
+        page->symbolic[offset >> 6] |= bit;
+        page->symbolic_values[offset] = value;
+    }
+}
+
+bool PagedRAM::find_differences(const PagedRAM & other, std::vector<uint16_t> & addresses, size_t limit) const {
+    size_t found = 0;
+    for (uint32_t i = 0; i < m_num_pages; ++i) {
+        const Page * mine = m_pages[i];
+        const Page * theirs = other.m_pages[i];
+        if (mine == theirs) {
+            continue;
+        }
+        for (uint32_t offset = 0; offset < PAGE_BYTES; ++offset) {
+            uint16_t addr = (uint16_t)(i * PAGE_BYTES + offset);
+            if (read(addr) != other.read(addr)) {
+                if (++found > limit) {
+                    return false;
+                }
+                addresses.push_back(addr);
+            }
+        }
+    }
+    return true;
+}
+
+void PagedRAM::collect_symbolic(std::vector<Expression> & values) const {
+    for (uint32_t i = 0; i < m_num_pages; ++i) {
+        const std::map<uint8_t, Expression> & symbolic = m_pages[i]->symbolic_values;
+        for (std::map<uint8_t, Expression>::const_iterator it = symbolic.begin(); it != symbolic.end(); ++it) {
+            values.push_back(it->second);
+        }
+    }
+}
+
+void PagedRAM::mark_live(ASTManager & m, std::unordered_set<const void*> & visited) const {
+    for (uint32_t i = 0; i < m_num_pages; ++i) {
+        const Page * page = m_pages[i];
+        if (!visited.insert(page).second) {
+            continue;
+        }
+        for (std::map<uint8_t, Expression>::const_iterator it = page->symbolic_values.begin(); it != page->symbolic_values.end(); ++it) {
+            m.mark_live(it->second);
+        }
+    }
+}
+
+void PagedRAM::relocate(ASTManager & m, std::unordered_set<const void*> & visited) {
+    // shared pages are updated in place, for every copy at once
+    for (uint32_t i = 0; i < m_num_pages; ++i) {
+        Page * page = m_pages[i];
+        if (!visited.insert(page).second) {
+            continue;
+        }
+        for (std::map<uint8_t, Expression>::iterator it = page->symbolic_values.begin(); it != page->symbolic_values.end(); ++it) {
+            it->second = m.relocate(it->second);
+        }
+    }
+    // the digest covers the node indices of symbolic cells
+    m_digest = StateDigest();
+    for (uint32_t addr = 0; addr < m_num_pages * PAGE_BYTES; ++addr) {
+        toggle_cell(m_digest, addr, read(addr));
+    }
+}
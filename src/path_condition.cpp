@@ -0,0 +1,159 @@
+#include "path_condition.h"
+#include "ast_manager.h"
+#include "state_digest.h"
+#include <algorithm>
+#include <iterator>
+
+static const std::vector<uint32_t> no_variables;
+
+PathCondition::PathCondition() : m_cell(NULL) {}
+
+PathCondition::PathCondition(Cell * cell) : m_cell(cell) {}
+
+PathCondition::PathCondition(const PathCondition & other) : m_cell(other.m_cell) {
+    if (m_cell != NULL) {
+        m_cell->references += 1;
+    }
+}
+
+PathCondition & PathCondition::operator=(const PathCondition & other) {
+    if (other.m_cell != NULL) {
+        other.m_cell->references += 1;
+    }
+    release(m_cell);
+    m_cell = other.m_cell;
+    return *this;
+}
+
+PathCondition::~PathCondition() {
+    release(m_cell);
+}
+
+void PathCondition::release(Cell * cell) {
+    // iteratively, so that dropping a long path does not recurse once per cell
+    while (cell != NULL) {
+        cell->references -= 1;
+        if (cell->references != 0) {
+            break;
+        }
+        Cell * prev = cell->prev;
+        delete cell;
+        cell = prev;
+    }
+}
+
+PathCondition PathCondition::get_prefix() const {
+    Cell * prev = m_cell->prev;
+    if (prev != NULL) {
+        prev->references += 1;
+    }
+    return PathCondition(prev);
+}
+
+PathCondition PathCondition::get_common_prefix(const PathCondition & other) const {
+    // paths that share a cell share everything before it, so walk both back to the same length
+    // and then in step until they meet
+    Cell * a = m_cell;
+    Cell * b = other.m_cell;
+    while (a != b) {
+        uint32_t a_count = (a == NULL) ? 0 : a->count;
+        uint32_t b_count = (b == NULL) ? 0 : b->count;
+        if (a_count >= b_count) {
+            a = a->prev;
+        }
+        if (b_count >= a_count) {
+            b = b->prev;
+        }
+    }
+    if (a != NULL) {
+        a->references += 1;
+    }
+    return PathCondition(a);
+}
+
+const std::vector<uint32_t> & PathCondition::get_variables() const {
+    return (m_cell == NULL) ? no_variables : *m_cell->variables;
+}
+
+bool PathCondition::mentions_any(const std::vector<uint32_t> & variables) const {
+    const std::vector<uint32_t> & mine = get_variables();
+    std::vector<uint32_t>::const_iterator a = mine.begin();
+    std::vector<uint32_t>::const_iterator b = variables.begin();
+    while (a != mine.end() && b != variables.end()) {
+        if (*a < *b) {
+            ++a;
+        } else if (*b < *a) {
+            ++b;
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PathCondition::collect(std::vector<Expression> & buffer) const {
+    size_t start = buffer.size();
+    buffer.resize(start + size());
+    size_t i = buffer.size();
+    for (const Cell * cell = m_cell; cell != NULL; cell = cell->prev) {
+        buffer[--i] = cell->assumption;
+    }
+}
+
+PathCondition PathCondition::extend(Expression assumption, const std::vector<uint32_t> & variables) const {
+    Cell * cell = new Cell;
+    cell->assumption = assumption;
+    cell->prev = m_cell;
+    cell->references = 1;
+    if (m_cell != NULL) {
+        m_cell->references += 1;
+    }
+    cell->count = size() + 1;
+    cell->hash = get_hash() + hash_assumption(assumption);
+    const std::vector<uint32_t> & previous = get_variables();
+    if (m_cell != NULL && std::includes(previous.begin(), previous.end(), variables.begin(), variables.end())) {
+        cell->variables = m_cell->variables;
+    } else {
+        std::vector<uint32_t> * merged = new std::vector<uint32_t>();
+        merged->reserve(previous.size() + variables.size());
+        std::set_union(previous.begin(), previous.end(), variables.begin(), variables.end(), std::back_inserter(*merged));
+        cell->variables.reset(merged);
+    }
+    return PathCondition(cell);
+}
+
+uint64_t PathCondition::hash_assumption(Expression assumption) {
+    return mix_hash(assumption.get_value() ^ ((uint64_t)assumption.get_kind() << 56) ^ ((uint64_t)assumption.get_width() << 48));
+}
+
+void PathCondition::mark_live(ASTManager & m, std::unordered_set<const void*> & visited) const {
+    for (const Cell * cell = m_cell; cell != NULL && visited.insert(cell).second; cell = cell->prev) {
+        m.mark_live(cell->assumption);
+        if (visited.insert(cell->variables.get()).second) {
+            for (size_t i = 0; i < cell->variables->size(); ++i) {
+                m.mark_live_node((*cell->variables)[i]);
+            }
+        }
+    }
+}
+
+void PathCondition::relocate(ASTManager & m, std::unordered_set<const void*> & visited) {
+    // the cells not seen yet, newest first; the hashes are recomputed oldest first
+    std::vector<Cell*> cells;
+    for (Cell * cell = m_cell; cell != NULL && visited.insert(cell).second; cell = cell->prev) {
+        cells.push_back(cell);
+    }
+    for (size_t i = cells.size(); i-- > 0; ) {
+        Cell * cell = cells[i];
+        cell->assumption = m.relocate(cell->assumption);
+        cell->hash = ((cell->prev == NULL) ? 0 : cell->prev->hash) + hash_assumption(cell->assumption);
+        // the variable sets are shared between cells and only read otherwise, so they are updated
+        // in place; relocation keeps the order of nodes, so they stay sorted
+        if (visited.insert(cell->variables.get()).second) {
+            std::vector<uint32_t> & variables = const_cast<std::vector<uint32_t>&>(*cell->variables);
+            for (size_t j = 0; j < variables.size(); ++j) {
+                variables[j] = m.relocate_node(variables[j]);
+            }
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#include "query_cache.h"
+#include <algorithm>
+
+QueryCache::QueryCache(size_t capacity) : m_capacity(capacity), m_num_hits(0), m_num_misses(0) {}
+
+void QueryCache::clear() {
+    m_entries.clear();
+    m_unsat_by_first.clear();
+    m_sat_by_member.clear();
+}
+
+ESolverStatus QueryCache::lookup(const std::vector<uint32_t> & query, Model ** model) {
+    // an UNSAT subset?
+    for (std::vector<uint32_t>::const_iterator q = query.begin(); q != query.end(); ++q) {
+        std::unordered_map<uint32_t, std::vector<uint32_t> >::iterator it = m_unsat_by_first.find(*q);
+        if (it == m_unsat_by_first.end()) {
+            continue;
+        }
+        for (std::vector<uint32_t>::iterator e = it->second.begin(); e != it->second.end(); ++e) {
+            const std::vector<uint32_t> & cached = m_entries[*e].assertions;
+            if (std::includes(query.begin(), query.end(), cached.begin(), cached.end())) {
+                m_num_hits += 1;
+                return UNSAT;
+            }
+        }
+    }
+    // a SAT superset? every candidate contains all of the query,
+    // so it is enough to look at those containing its least common member
+    const std::vector<uint32_t> * candidates = NULL;
+    for (std::vector<uint32_t>::const_iterator q = query.begin(); q != query.end(); ++q) {
+        std::unordered_map<uint32_t, std::vector<uint32_t> >::iterator it = m_sat_by_member.find(*q);
+        if (it == m_sat_by_member.end()) {
+            candidates = NULL;
+            break;
+        }
+        if (candidates == NULL || it->second.size() < candidates->size()) {
+            candidates = &it->second;
+        }
+    }
+    if (candidates != NULL) {
+        for (std::vector<uint32_t>::const_iterator e = candidates->begin(); e != candidates->end(); ++e) {
+            const Entry & entry = m_entries[*e];
+            if (model != NULL && !entry.has_model) {
+                continue;
+            }
+            if (std::includes(entry.assertions.begin(), entry.assertions.end(), query.begin(), query.end())) {
+                if (model != NULL) {
+                    **model = entry.model;
+                }
+                m_num_hits += 1;
+                return SAT;
+            }
+        }
+    }
+    m_num_misses += 1;
+    return UNKNOWN;
+}
+
+void QueryCache::insert(const std::vector<uint32_t> & query, ESolverStatus result, Model * model) {
+    if ((result != SAT && result != UNSAT) || query.empty()) {
+        return;
+    }
+    if (m_entries.size() >= m_capacity) {
+        // start over rather than track which entries are still useful
+        clear();
+    }
+    uint32_t index = m_entries.size();
+    m_entries.push_back(Entry());
+    Entry & entry = m_entries.back();
+    entry.assertions = query;
+    entry.has_model = (model != NULL);
+    if (model != NULL) {
+        entry.model = *model;
+    }
+    if (result == UNSAT) {
+        m_unsat_by_first[query.front()].push_back(index);
+    } else {
+        for (std::vector<uint32_t>::const_iterator q = query.begin(); q != query.end(); ++q) {
+            m_sat_by_member[*q].push_back(index);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#include "rom_image.h"
+#include "trace.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <errno.h>
+
+RomImage::RomImage(uint8_t * data, size_t size, bool mapped) : m_data(data), m_size(size), m_mapped(mapped) {}
+
+RomImage::~RomImage() {
+    if (m_mapped) {
+        munmap(m_data, m_size);
+    } else {
+        delete[] m_data;
+    }
+}
+
+RomImage * RomImage::map_file(const char * filename) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        TRACE("ines", tout << "could not open " << filename << ": " << std::strerror(errno) << std::endl;);
+        throw "could not open ROM image";
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        TRACE("ines", tout << "could not stat " << filename << ": " << std::strerror(errno) << std::endl;);
+        close(fd);
+        throw "could not open ROM image";
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        throw "ROM image is empty";
+    }
+    void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid without the descriptor
+    close(fd);
+    if (data == MAP_FAILED) {
+        TRACE("ines", tout << "could not map " << filename << ": " << std::strerror(errno) << std::endl;);
+        throw "could not map ROM image";
+    }
+    TRACE("ines", tout << "mapped " << filename << " (" << st.st_size << " bytes)" << std::endl;);
+    return new RomImage(static_cast<uint8_t*>(data), st.st_size, true);
+}
+
+RomImage * RomImage::adopt_buffer(uint8_t * data, size_t size) {
+    return new RomImage(data, size, false);
+}
+
+const uint8_t * RomImage::get_data() const {
+    return m_data;
+}
+
+size_t RomImage::get_size() const {
+    return m_size;
+}
@@ -0,0 +1,441 @@
+#include "sat_solver.h"
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#define VAR_DECAY (0.95)
+#define CLAUSE_DECAY (0.999)
+#define RESTART_BASE (100)
+
+// the Luby sequence 1 1 2 1 1 2 4 1 1 2 ..., scaled by powers of y
+static double luby(double y, int x) {
+    int size, seq;
+    for (size = 1, seq = 0; size < x + 1; seq++, size = 2 * size + 1)
+        ;
+    while (size - 1 != x) {
+        size = (size - 1) >> 1;
+        seq--;
+        x = x % size;
+    }
+    return std::pow(y, seq);
+}
+
+SATSolver::SATSolver() : m_ok(true), m_qhead(0), m_var_inc(1.0), m_clause_inc(1.0), m_max_learnts(0),
+        m_max_conflicts(0), m_max_milliseconds(0), m_num_conflicts(0), m_num_decisions(0), m_num_propagations(0) {}
+
+SATSolver::~SATSolver() {
+    for (std::vector<Clause*>::iterator it = m_clauses.begin(); it != m_clauses.end(); ++it) {
+        delete *it;
+    }
+    for (std::vector<Clause*>::iterator it = m_learnts.begin(); it != m_learnts.end(); ++it) {
+        delete *it;
+    }
+}
+
+uint32_t SATSolver::new_var() {
+    uint32_t var = m_assigns.size();
+    m_assigns.push_back(0);
+    m_levels.push_back(0);
+    m_reasons.push_back(NULL);
+    m_polarity.push_back(false);
+    m_activity.push_back(0.0);
+    m_seen.push_back(false);
+    m_heap_index.push_back(-1);
+    m_watches.push_back(std::vector<Clause*>());
+    m_watches.push_back(std::vector<Clause*>());
+    heap_insert(var);
+    return var;
+}
+
+bool SATSolver::add_clause(std::vector<Literal> lits) {
+    if (!m_ok) {
+        return false;
+    }
+    // drop duplicate literals and literals that are false at the root;
+    // ignore the clause if it is a tautology or already satisfied
+    std::sort(lits.begin(), lits.end());
+    size_t j = 0;
+    for (size_t i = 0; i < lits.size(); ++i) {
+        if (value(lits[i]) == 1 || (i + 1 < lits.size() && lits[i + 1] == negate(lits[i]))) {
+            return true;
+        }
+        if (value(lits[i]) == 0 && (j == 0 || lits[j - 1] != lits[i])) {
+            lits[j++] = lits[i];
+        }
+    }
+    lits.resize(j);
+
+    if (lits.empty()) {
+        m_ok = false;
+    } else if (lits.size() == 1) {
+        enqueue(lits[0], NULL);
+        m_ok = (propagate() == NULL);
+    } else {
+        Clause * c = new Clause;
+        c->learnt = false;
+        c->activity = 0.0;
+        c->lits.swap(lits);
+        m_clauses.push_back(c);
+        attach(c);
+    }
+    return m_ok;
+}
+
+void SATSolver::attach(Clause * c) {
+    m_watches[c->lits[0]].push_back(c);
+    m_watches[c->lits[1]].push_back(c);
+}
+
+void SATSolver::detach(Clause * c) {
+    for (unsigned int i = 0; i < 2; ++i) {
+        std::vector<Clause*> & ws = m_watches[c->lits[i]];
+        ws.erase(std::find(ws.begin(), ws.end(), c));
+    }
+}
+
+bool SATSolver::is_locked(Clause * c) const {
+    uint32_t var = literal_var(c->lits[0]);
+    return m_reasons[var] == c && value(c->lits[0]) == 1;
+}
+
+void SATSolver::enqueue(Literal lit, Clause * reason) {
+    uint32_t var = literal_var(lit);
+    m_assigns[var] = literal_sign(lit) ? -1 : 1;
+    m_levels[var] = decision_level();
+    m_reasons[var] = reason;
+    m_trail.push_back(lit);
+}
+
+SATSolver::Clause * SATSolver::propagate() {
+    Clause * conflict = NULL;
+    while (m_qhead < m_trail.size()) {
+        Literal false_lit = negate(m_trail[m_qhead++]);
+        std::vector<Clause*> & ws = m_watches[false_lit];
+        m_num_propagations += 1;
+        size_t i = 0, j = 0;
+        while (i < ws.size()) {
+            Clause * c = ws[i++];
+            std::vector<Literal> & lits = c->lits;
+            // make sure the false literal is lits[1]
+            if (lits[0] == false_lit) {
+                lits[0] = lits[1];
+                lits[1] = false_lit;
+            }
+            if (value(lits[0]) == 1) {
+                ws[j++] = c;
+                continue;
+            }
+            // look for a new literal to watch
+            bool found = false;
+            for (size_t k = 2; k < lits.size(); ++k) {
+                if (value(lits[k]) != -1) {
+                    lits[1] = lits[k];
+                    lits[k] = false_lit;
+                    m_watches[lits[1]].push_back(c);
+                    found = true;
+                    break;
+                }
+            }
+            if (found) {
+                continue;
+            }
+            // the clause is unit or conflicting
+            ws[j++] = c;
+            if (value(lits[0]) == -1) {
+                conflict = c;
+                m_qhead = m_trail.size();
+                while (i < ws.size()) {
+                    ws[j++] = ws[i++];
+                }
+            } else {
+                enqueue(lits[0], c);
+            }
+        }
+        ws.resize(j);
+        if (conflict != NULL) {
+            break;
+        }
+    }
+    return conflict;
+}
+
+void SATSolver::analyze(Clause * conflict, std::vector<Literal> & learnt, uint32_t & backtrack_level) {
+    int path_count = 0;
+    Literal p = 0;
+    bool have_p = false;
+    size_t index = m_trail.size();
+    Clause * c = conflict;
+
+    learnt.clear();
+    learnt.push_back(0); // placeholder for the asserting literal
+    do {
+        if (c->learnt) {
+            bump_clause(c);
+        }
+        // the implied literal of a reason clause is lits[0] and has already been resolved on
+        for (size_t k = have_p ? 1 : 0; k < c->lits.size(); ++k) {
+            Literal q = c->lits[k];
+            uint32_t var = literal_var(q);
+            if (!m_seen[var] && m_levels[var] > 0) {
+                bump_var(var);
+                m_seen[var] = true;
+                if (m_levels[var] >= decision_level()) {
+                    path_count += 1;
+                } else {
+                    learnt.push_back(q);
+                }
+            }
+        }
+        // next literal on the trail that takes part in the conflict
+        while (!m_seen[literal_var(m_trail[--index])])
+            ;
+        p = m_trail[index];
+        have_p = true;
+        c = m_reasons[literal_var(p)];
+        m_seen[literal_var(p)] = false;
+        path_count -= 1;
+    } while (path_count > 0);
+    learnt[0] = negate(p);
+
+    // the second watch must be the literal assigned at the highest remaining level
+    if (learnt.size() == 1) {
+        backtrack_level = 0;
+    } else {
+        size_t max_i = 1;
+        for (size_t i = 2; i < learnt.size(); ++i) {
+            if (m_levels[literal_var(learnt[i])] > m_levels[literal_var(learnt[max_i])]) {
+                max_i = i;
+            }
+        }
+        std::swap(learnt[1], learnt[max_i]);
+        backtrack_level = m_levels[literal_var(learnt[1])];
+    }
+    for (size_t i = 1; i < learnt.size(); ++i) {
+        m_seen[literal_var(learnt[i])] = false;
+    }
+}
+
+void SATSolver::cancel_until(uint32_t level) {
+    if (decision_level() <= level) {
+        return;
+    }
+    for (size_t i = m_trail.size(); i > m_trail_lim[level]; --i) {
+        uint32_t var = literal_var(m_trail[i - 1]);
+        m_polarity[var] = (m_assigns[var] == 1);
+        m_assigns[var] = 0;
+        m_reasons[var] = NULL;
+        heap_insert(var);
+    }
+    m_trail.resize(m_trail_lim[level]);
+    m_trail_lim.resize(level);
+    m_qhead = m_trail.size();
+}
+
+bool SATSolver::pick_branch(Literal & lit) {
+    while (!m_heap.empty()) {
+        uint32_t var = heap_pop();
+        if (m_assigns[var] == 0) {
+            lit = mk_literal(var, !m_polarity[var]);
+            return true;
+        }
+    }
+    return false;
+}
+
+ESATResult SATSolver::search(uint64_t conflict_limit) {
+    uint64_t conflicts = 0;
+    std::vector<Literal> learnt;
+    for (;;) {
+        Clause * conflict = propagate();
+        if (conflict != NULL) {
+            m_num_conflicts += 1;
+            conflicts += 1;
+            if (decision_level() == 0) {
+                // unsatisfiable regardless of assumptions
+                m_ok = false;
+                return SAT_RESULT_UNSAT;
+            }
+            uint32_t backtrack_level;
+            analyze(conflict, learnt, backtrack_level);
+            cancel_until(backtrack_level);
+            if (learnt.size() == 1) {
+                enqueue(learnt[0], NULL);
+            } else {
+                Clause * c = new Clause;
+                c->learnt = true;
+                c->activity = 0.0;
+                c->lits = learnt;
+                m_learnts.push_back(c);
+                attach(c);
+                bump_clause(c);
+                enqueue(learnt[0], c);
+            }
+            m_var_inc /= VAR_DECAY;
+            m_clause_inc /= CLAUSE_DECAY;
+        } else {
+            if (conflicts >= conflict_limit) {
+                cancel_until(0);
+                return SAT_RESULT_UNKNOWN;
+            }
+            if (m_learnts.size() >= m_max_learnts + m_trail.size()) {
+                reduce_learnts();
+            }
+            Literal next = 0;
+            bool have_next = false;
+            while (decision_level() < m_assumptions.size()) {
+                Literal p = m_assumptions[decision_level()];
+                if (value(p) == 1) {
+                    // already implied; open an empty level to keep levels and assumptions aligned
+                    m_trail_lim.push_back(m_trail.size());
+                } else if (value(p) == -1) {
+                    // the assumptions contradict the clause set
+                    return SAT_RESULT_UNSAT;
+                } else {
+                    next = p;
+                    have_next = true;
+                    break;
+                }
+            }
+            if (!have_next && !pick_branch(next)) {
+                // every variable is assigned without conflict
+                return SAT_RESULT_SAT;
+            }
+            m_num_decisions += 1;
+            m_trail_lim.push_back(m_trail.size());
+            enqueue(next, NULL);
+        }
+    }
+}
+
+ESATResult SATSolver::solve(const std::vector<Literal> & assumptions) {
+    if (!m_ok) {
+        return SAT_RESULT_UNSAT;
+    }
+    m_assumptions = assumptions;
+    m_max_learnts = std::max((size_t)1000, m_clauses.size() / 3);
+    uint64_t conflict_stop = m_num_conflicts + m_max_conflicts;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_max_milliseconds);
+    ESATResult result = SAT_RESULT_UNKNOWN;
+    for (int restarts = 0; result == SAT_RESULT_UNKNOWN; ++restarts) {
+        uint64_t conflict_limit = (uint64_t)(luby(2, restarts) * RESTART_BASE);
+        if (m_max_conflicts != 0) {
+            if (m_num_conflicts >= conflict_stop) {
+                break;
+            }
+            conflict_limit = std::min(conflict_limit, conflict_stop - m_num_conflicts);
+        }
+        if (m_max_milliseconds != 0 && std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        result = search(conflict_limit);
+        m_max_learnts += m_max_learnts / 10;
+    }
+    if (result == SAT_RESULT_SAT) {
+        m_model.resize(m_assigns.size());
+        for (uint32_t var = 0; var < m_assigns.size(); ++var) {
+            m_model[var] = (m_assigns[var] == 1);
+        }
+    }
+    cancel_until(0);
+    return result;
+}
+
+// remove the less active half of the learnt clauses that are not currently reasons
+void SATSolver::reduce_learnts() {
+    std::vector<Clause*> sorted(m_learnts);
+    std::sort(sorted.begin(), sorted.end(), [](const Clause * a, const Clause * b) {
+        return a->activity < b->activity;
+    });
+    size_t limit = sorted.size() / 2;
+    m_learnts.clear();
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        Clause * c = sorted[i];
+        if (i < limit && c->lits.size() > 2 && !is_locked(c)) {
+            detach(c);
+            delete c;
+        } else {
+            m_learnts.push_back(c);
+        }
+    }
+}
+
+void SATSolver::bump_var(uint32_t var) {
+    m_activity[var] += m_var_inc;
+    if (m_activity[var] > 1e100) {
+        for (size_t i = 0; i < m_activity.size(); ++i) {
+            m_activity[i] *= 1e-100;
+        }
+        m_var_inc *= 1e-100;
+    }
+    if (m_heap_index[var] >= 0) {
+        heap_up(m_heap_index[var]);
+    }
+}
+
+void SATSolver::bump_clause(Clause * c) {
+    c->activity += m_clause_inc;
+    if (c->activity > 1e20) {
+        for (std::vector<Clause*>::iterator it = m_learnts.begin(); it != m_learnts.end(); ++it) {
+            (*it)->activity *= 1e-20;
+        }
+        m_clause_inc *= 1e-20;
+    }
+}
+
+void SATSolver::heap_insert(uint32_t var) {
+    if (m_heap_index[var] >= 0) {
+        return;
+    }
+    m_heap_index[var] = m_heap.size();
+    m_heap.push_back(var);
+    heap_up(m_heap.size() - 1);
+}
+
+void SATSolver::heap_up(size_t i) {
+    uint32_t var = m_heap[i];
+    while (i > 0) {
+        size_t parent = (i - 1) >> 1;
+        if (m_activity[m_heap[parent]] >= m_activity[var]) {
+            break;
+        }
+        m_heap[i] = m_heap[parent];
+        m_heap_index[m_heap[i]] = i;
+        i = parent;
+    }
+    m_heap[i] = var;
+    m_heap_index[var] = i;
+}
+
+void SATSolver::heap_down(size_t i) {
+    uint32_t var = m_heap[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= m_heap.size()) {
+            break;
+        }
+        if (child + 1 < m_heap.size() && m_activity[m_heap[child + 1]] > m_activity[m_heap[child]]) {
+            child += 1;
+        }
+        if (m_activity[m_heap[child]] <= m_activity[var]) {
+            break;
+        }
+        m_heap[i] = m_heap[child];
+        m_heap_index[m_heap[i]] = i;
+        i = child;
+    }
+    m_heap[i] = var;
+    m_heap_index[var] = i;
+}
+
+uint32_t SATSolver::heap_pop() {
+    uint32_t var = m_heap[0];
+    uint32_t last = m_heap.back();
+    m_heap.pop_back();
+    m_heap_index[var] = -1;
+    if (!m_heap.empty()) {
+        m_heap[0] = last;
+        m_heap_index[last] = 0;
+        heap_down(0);
+    }
+    return var;
+}
@@ -0,0 +1,74 @@
+#include "smt2_writer.h"
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include "trace.h"
+
+SMT2Writer::SMT2Writer(int fd) : m_fd(fd), m_out(NULL), m_echo(NULL), m_pos(0) {}
+
+SMT2Writer::SMT2Writer(std::string & out) : m_fd(-1), m_out(&out), m_echo(NULL), m_pos(0) {}
+
+SMT2Writer::~SMT2Writer() {
+    // flush() can throw, so it has to be called explicitly before destruction
+}
+
+void SMT2Writer::write(const char * str) {
+    write(str, strlen(str));
+}
+
+void SMT2Writer::write(const char * data, size_t len) {
+    while (len > 0) {
+        if (m_pos == sizeof(m_buffer)) {
+            flush();
+        }
+        size_t chunk = sizeof(m_buffer) - m_pos;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(m_buffer + m_pos, data, chunk);
+        m_pos += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+void SMT2Writer::write_uint(uint64_t val) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + (val % 10);
+        val /= 10;
+    } while (val != 0);
+    while (n > 0) {
+        write(digits[--n]);
+    }
+}
+
+void SMT2Writer::set_echo(std::ostream * echo) {
+    m_echo = echo;
+}
+
+void SMT2Writer::flush() {
+    if (m_echo != NULL) {
+        m_echo->write(m_buffer, m_pos);
+    }
+    if (m_out != NULL) {
+        m_out->append(m_buffer, m_pos);
+    } else {
+        const char * buffer = m_buffer;
+        size_t bytes_remaining = m_pos;
+        while (bytes_remaining > 0) {
+            ssize_t bytes_written = ::write(m_fd, buffer, bytes_remaining);
+            if (bytes_written == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                TRACE("solver", tout << "could not write instance: " << std::strerror(errno) << std::endl;);
+                throw std::strerror(errno);
+            }
+            bytes_remaining -= bytes_written;
+            buffer += bytes_written;
+        }
+    }
+    m_pos = 0;
+}
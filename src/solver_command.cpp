@@ -0,0 +1,421 @@
+#include "solver_command.h"
+#include "trace.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <errno.h>
+#include <spawn.h>
+
+bool SolverCommand::lookup(const std::string & name, SolverCommand & command) {
+    command.name = name;
+    command.arguments.clear();
+    command.model_arguments.clear();
+    command.model_format = MODEL_FORMAT_SMTLIB2;
+    if (name == "stp") {
+        command.arguments.push_back("stp");
+        command.arguments.push_back("--SMTLIB2");
+        command.model_arguments.push_back("--print-counterex");
+        command.model_format = MODEL_FORMAT_STP;
+    } else if (name == "z3") {
+        command.arguments.push_back("z3");
+        command.arguments.push_back("-in");
+        command.arguments.push_back("-smt2");
+    } else if (name == "cvc4" || name == "cvc5") {
+        command.arguments.push_back(name);
+        command.arguments.push_back("--lang=smt2");
+        command.arguments.push_back("--incremental");
+    } else if (name == "yices") {
+        command.arguments.push_back("yices-smt2");
+        command.arguments.push_back("--incremental");
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// a solver that dies should show up as a write error rather than kill us
+static bool ignore_sigpipe() {
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+}
+
+pid_t SolverCommand::spawn(bool want_model, uint64_t memory_limit, int & input, int & output) const {
+    static const bool sigpipe_ignored = ignore_sigpipe();
+    (void)sigpipe_ignored;
+    int p_solver_input[2];
+    int p_solver_output[2];
+
+    // the argument vector points straight into our strings; posix_spawnp() copies nothing it does not need
+    std::vector<char*> argv;
+    argv.reserve(arguments.size() + model_arguments.size() + 1);
+    for (std::vector<std::string>::const_iterator it = arguments.begin(); it != arguments.end(); ++it) {
+        argv.push_back(const_cast<char*>(it->c_str()));
+    }
+    if (want_model) {
+        for (std::vector<std::string>::const_iterator it = model_arguments.begin(); it != model_arguments.end(); ++it) {
+            argv.push_back(const_cast<char*>(it->c_str()));
+        }
+    }
+    argv.push_back(NULL);
+
+    // solvers may be started from several threads at once, so the pipes must never be
+    // inherited by another solver, not even before we get to mark them close-on-exec
+    if (pipe2(p_solver_input, O_CLOEXEC) == -1) {
+        TRACE("solver", tout << "failed to create pipe: " << std::strerror(errno) << std::endl;);
+        return -1;
+    }
+    if (pipe2(p_solver_output, O_CLOEXEC) == -1) {
+        TRACE("solver", tout << "failed to create pipe: " << std::strerror(errno) << std::endl;);
+        close(p_solver_input[0]);
+        close(p_solver_input[1]);
+        return -1;
+    }
+    // posix_spawnp() starts the solver without duplicating our address space (glibc uses
+    // a vfork-style clone), so the cost of starting it does not grow with the size of
+    // the explorer; dup2() clears close-on-exec on the copies
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, p_solver_input[0], 0);
+    posix_spawn_file_actions_adddup2(&actions, p_solver_output[1], 1);
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], &actions, NULL, &argv[0], environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(p_solver_input[0]);
+    close(p_solver_output[1]);
+    if (err != 0) {
+        TRACE("solver", tout << "could not start " << name << ": " << std::strerror(err) << std::endl;);
+        close(p_solver_input[1]);
+        close(p_solver_output[0]);
+        return -1;
+    }
+    if (memory_limit != 0) {
+        // the solver has barely started, so it is still well below any sensible limit
+        struct rlimit limit;
+        limit.rlim_cur = memory_limit;
+        limit.rlim_max = memory_limit;
+        if (prlimit(pid, RLIMIT_AS, &limit, NULL) == -1) {
+            TRACE("solver", tout << "could not limit memory of " << name << ": " << std::strerror(errno) << std::endl;);
+        }
+    }
+    input = p_solver_input[1];
+    output = p_solver_output[0];
+    TRACE("solver", tout << "started " << name << " as process " << pid << std::endl;);
+    return pid;
+}
+
+std::string SolverCommand::get_prologue(bool want_model) const {
+    if (want_model && model_format == MODEL_FORMAT_SMTLIB2) {
+        return "(set-option :produce-models true)\n(set-logic QF_BV)\n";
+    }
+    return "(set-logic QF_BV)\n";
+}
+
+std::string SolverCommand::get_epilogue(bool want_model) const {
+    // with --print-counterex, STP prints the model by itself
+    if (want_model && model_format == MODEL_FORMAT_SMTLIB2) {
+        return "(check-sat)\n(get-model)\n(exit)\n";
+    }
+    return "(check-sat)\n(exit)\n";
+}
+
+/*
+ * The responses are scanned where they lie: lines and tokens are (pointer, length)
+ * views into the response, and only the names that end up in a model are copied.
+ */
+
+// the next line of [pos, end) without its line terminator; false at the end
+static bool next_line(const char *& pos, const char * end, const char *& line, size_t & length) {
+    if (pos >= end) {
+        return false;
+    }
+    line = pos;
+    const char * newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+    const char * line_end = (newline != NULL) ? newline : end;
+    pos = (newline != NULL) ? newline + 1 : end;
+    if (line_end > line && line_end[-1] == '\r') {
+        line_end -= 1;
+    }
+    length = line_end - line;
+    return true;
+}
+
+static inline bool equals(const char * text, size_t length, const char * word) {
+    size_t word_length = strlen(word);
+    return length == word_length && memcmp(text, word, length) == 0;
+}
+
+ESolverStatus SolverCommand::parse_status(const std::string & response) {
+    // STP prints its counterexample before the answer, other solvers their model after it
+    const char * pos = response.data();
+    const char * end = pos + response.size();
+    const char * line;
+    size_t length;
+    while (next_line(pos, end, line, length)) {
+        if (equals(line, length, "sat")) {
+            return SAT;
+        } else if (equals(line, length, "unsat")) {
+            return UNSAT;
+        } else if (equals(line, length, "unknown")) {
+            return UNKNOWN;
+        }
+    }
+    return ERROR;
+}
+
+/*
+ * A token of an S-expression: "(", ")", or an atom. Quoted symbols are returned
+ * without their bars.
+ */
+struct SExprToken {
+    const char * text;
+    size_t length;
+
+    bool is(const char * word) const { return equals(text, length, word); }
+    bool is_open() const { return length == 1 && text[0] == '(' ; }
+    bool is_close() const { return length == 1 && text[0] == ')'; }
+};
+
+// read the token at 'pos'; false at the end of the input
+static bool next_token(const char *& pos, const char * end, SExprToken & token) {
+    // skip whitespace and comments
+    while (pos < end) {
+        if (isspace((unsigned char)*pos)) {
+            pos += 1;
+        } else if (*pos == ';') {
+            while (pos < end && *pos != '\n') {
+                pos += 1;
+            }
+        } else {
+            break;
+        }
+    }
+    if (pos >= end) {
+        return false;
+    }
+    if (*pos == '(' || *pos == ')') {
+        token.text = pos;
+        token.length = 1;
+        pos += 1;
+        return true;
+    }
+    if (*pos == '|' || *pos == '"') {
+        // quoted symbol or string literal; the quotes are not part of a symbol's name
+        char quote = *pos;
+        const char * close = static_cast<const char*>(memchr(pos + 1, quote, end - pos - 1));
+        if (close == NULL) {
+            return false;
+        }
+        if (quote == '|') {
+            token.text = pos + 1;
+            token.length = close - pos - 1;
+        } else {
+            token.text = pos;
+            token.length = close - pos + 1;
+        }
+        pos = close + 1;
+        return true;
+    }
+    token.text = pos;
+    while (pos < end && !isspace((unsigned char)*pos) && *pos != '(' && *pos != ')') {
+        pos += 1;
+    }
+    token.length = pos - token.text;
+    return true;
+}
+
+// parse an unsigned number of the given base from an atom
+static uint64_t parse_number(const char * text, size_t length, unsigned int base) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < length; ++i) {
+        char c = text[i];
+        unsigned int digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            break;
+        }
+        if (digit >= base) {
+            break;
+        }
+        value = value * base + digit;
+    }
+    return value;
+}
+
+/*
+ * Read the rest of the list whose opening parenthesis has already been read. Its first
+ * (up to) three elements are returned in 'parts' if they are all atoms, as in (_ BitVec 8)
+ * or (_ bv5 8); 'count' is 0 for any other list.
+ */
+static bool read_list(const char *& pos, const char * end, SExprToken parts[3], unsigned int & count) {
+    unsigned int depth = 1;
+    bool flat = true;
+    SExprToken token;
+    count = 0;
+    while (depth > 0) {
+        if (!next_token(pos, end, token)) {
+            return false;
+        }
+        if (token.is_open()) {
+            depth += 1;
+            flat = false;
+        } else if (token.is_close()) {
+            depth -= 1;
+        } else if (depth == 1 && count < 3) {
+            parts[count++] = token;
+        }
+    }
+    if (!flat) {
+        count = 0;
+    }
+    return true;
+}
+
+// value and width of a bit-vector literal (#x.., #b.., or (_ bvN w)) starting with 'token'
+static bool parse_bv_literal(const char *& pos, const char * end, const SExprToken & token,
+        uint64_t & value, unsigned int & width, bool & is_literal) {
+    is_literal = false;
+    if (!token.is_open()) {
+        if (token.length > 2 && token.text[0] == '#' && token.text[1] == 'x') {
+            value = parse_number(token.text + 2, token.length - 2, 16);
+            width = 4 * (token.length - 2);
+            is_literal = true;
+        } else if (token.length > 2 && token.text[0] == '#' && token.text[1] == 'b') {
+            value = parse_number(token.text + 2, token.length - 2, 2);
+            width = token.length - 2;
+            is_literal = true;
+        }
+        return true;
+    }
+    SExprToken parts[3];
+    unsigned int count;
+    if (!read_list(pos, end, parts, count)) {
+        return false;
+    }
+    if (count == 3 && parts[0].is("_") && parts[1].length > 2 && memcmp(parts[1].text, "bv", 2) == 0) {
+        value = parse_number(parts[1].text + 2, parts[1].length - 2, 10);
+        width = parse_number(parts[2].text, parts[2].length, 10);
+        is_literal = true;
+    }
+    return true;
+}
+
+/*
+ * Parse the rest of a (define-fun name () sort value) whose "(define-fun" has been read,
+ * and add it to 'model' if it defines a bit-vector constant.
+ */
+static bool parse_definition(const char *& pos, const char * end, Model & model) {
+    SExprToken name, token, parts[3];
+    unsigned int count;
+    if (!next_token(pos, end, name) || name.is_open() || name.is_close()) {
+        return false;
+    }
+    if (!next_token(pos, end, token) || !token.is_open() || !next_token(pos, end, token)) {
+        return false;
+    }
+    if (!token.is_close()) {
+        // only constants, which have an empty parameter list; skip the parameters and the rest of the definition
+        if (token.is_open() && !read_list(pos, end, parts, count)) {
+            return false;
+        }
+        return read_list(pos, end, parts, count) && read_list(pos, end, parts, count);
+    }
+    // the sort, e.g. (_ BitVec 8)
+    unsigned int sort_width = 0;
+    if (!next_token(pos, end, token)) {
+        return false;
+    }
+    if (token.is_open()) {
+        if (!read_list(pos, end, parts, count)) {
+            return false;
+        }
+        if (count == 3 && parts[0].is("_") && parts[1].is("BitVec")) {
+            sort_width = parse_number(parts[2].text, parts[2].length, 10);
+        }
+    }
+    uint64_t value;
+    unsigned int width;
+    bool is_literal;
+    if (!next_token(pos, end, token) || !parse_bv_literal(pos, end, token, value, width, is_literal)) {
+        return false;
+    }
+    if (is_literal) {
+        if (sort_width != 0) {
+            width = sort_width;
+        }
+        std::string var_name(name.text, name.length);
+        TRACE("solver", tout << "set " << var_name << " = " << value << std::endl;);
+        model.add_variable(var_name, value, width);
+    }
+    // the definition's closing parenthesis
+    return read_list(pos, end, parts, count);
+}
+
+bool SolverCommand::parse_model(const std::string & response, Model & model) const {
+    const char * pos = response.data();
+    const char * end = pos + response.size();
+    if (model_format == MODEL_FORMAT_STP) {
+        // the following is so STP-specific that it isn't even funny
+        // ASSERT( foo = 0x01 );
+        const char * line;
+        size_t length;
+        while (next_line(pos, end, line, length)) {
+            // split the line at single spaces
+            const char * tokens[4];
+            size_t lengths[4];
+            unsigned int count = 0;
+            const char * line_end = line + length;
+            const char * token = line;
+            while (count < 4) {
+                const char * space = static_cast<const char*>(memchr(token, ' ', line_end - token));
+                const char * token_end = (space != NULL) ? space : line_end;
+                tokens[count] = token;
+                lengths[count] = token_end - token;
+                count += 1;
+                if (space == NULL) {
+                    break;
+                }
+                token = space + 1;
+            }
+            if (count < 4 || !equals(tokens[0], lengths[0], "ASSERT(")) {
+                continue;
+            }
+            std::string var_name(tokens[1], lengths[1]);
+            const char * var_val = tokens[3];
+            size_t val_length = lengths[3];
+            TRACE("solver", tout << "set " << var_name << " = " << std::string(var_val, val_length) << std::endl;);
+            // so far I've seen 0b[binary constant] and 0x[hex constant]
+            if (val_length >= 2 && var_val[0] == '0' && var_val[1] == 'x') {
+                model.add_variable(var_name, parse_number(var_val + 2, val_length - 2, 16), 4 * (val_length - 2));
+            } else if (val_length >= 2 && var_val[0] == '0' && var_val[1] == 'b') {
+                model.add_variable(var_name, parse_number(var_val + 2, val_length - 2, 2), val_length - 2);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+    // definitions may sit at any depth, inside a (model ...) wrapper or a bare list
+    SExprToken token;
+    bool after_open = false;
+    while (next_token(pos, end, token)) {
+        if (after_open && token.is("define-fun")) {
+            if (!parse_definition(pos, end, model)) {
+                return false;
+            }
+            after_open = false;
+            continue;
+        }
+        after_open = token.is_open();
+    }
+    return true;
+}
@@ -0,0 +1,49 @@
+#include "solver_pool.h"
+
+SolverPool::SolverPool(unsigned int num_workers) : m_stopping(false) {
+    for (unsigned int i = 0; i < num_workers; ++i) {
+        m_workers.push_back(std::thread(&SolverPool::run_worker, this));
+    }
+}
+
+SolverPool::~SolverPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_jobs.clear();
+    }
+    m_job_available.notify_all();
+    for (std::vector<std::thread>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+        it->join();
+    }
+}
+
+std::future<ESolverStatus> SolverPool::submit(std::function<ESolverStatus()> job) {
+    std::packaged_task<ESolverStatus()> task(job);
+    std::future<ESolverStatus> answer = task.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::move(task));
+    }
+    m_job_available.notify_one();
+    return answer;
+}
+
+void SolverPool::run_worker() {
+    for (;;) {
+        std::packaged_task<ESolverStatus()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_stopping && m_jobs.empty()) {
+                m_job_available.wait(lock);
+            }
+            if (m_stopping) {
+                return;
+            }
+            task = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        // exceptions end up in the job's future
+        task();
+    }
+}